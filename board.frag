@@ -0,0 +1,53 @@
+// #version and the Globals block come from shader_header in main.c
+out vec4 FragColor;
+
+in vec2 board_pos;
+
+// r = tile type, g = entity, one texel per tile
+uniform usampler2D board;
+uniform bool exit_open;
+
+// same values as Tile_Type and Entity_Type in main.c
+#define TILE_TYPE_WALL 1u
+#define TILE_TYPE_WATER 2u
+#define TILE_TYPE_GOAL 3u
+#define TILE_TYPE_ICE 4u
+#define TILE_TYPE_SNOW 5u
+#define ENTITY_TYPE_COLLECTABLE 4u
+
+void main() {
+	ivec2 tile = min(ivec2(board_pos), ivec2(7));
+	uvec2 code = texelFetch(board, tile, 0).rg;
+	// game pixels into the tile, 16 to a tile
+	vec2 p = fract(board_pos) * 16.0;
+	// one screen pixel, for the closed goal's outline
+	vec2 line = fwidth(p);
+
+	vec4 color = outline_color;
+	if (all(greaterThanEqual(p, vec2(1.0))) && all(lessThan(p, vec2(15.0))))
+		color = fill_color;
+
+	if (code.r == TILE_TYPE_WATER) {
+		color = water_color;
+	} else if (code.r == TILE_TYPE_ICE) {
+		// ice keeps the outline, only the inside changes
+		if (color == fill_color)
+			color = ice_color;
+	} else if (code.r == TILE_TYPE_SNOW) {
+		if (color == fill_color)
+			color = snow_color;
+	} else if (code.r == TILE_TYPE_WALL) {
+		color = wall_color;
+	} else if (code.r == TILE_TYPE_GOAL) {
+		// closed goal is the square's triangles drawn as lines
+		bool edge = any(lessThan(p, line)) || any(greaterThan(p, 16.0 - line));
+		bool diagonal = abs(p.x + p.y - 16.0) < line.x;
+		if (exit_open || edge || diagonal)
+			color = goal_color;
+	}
+
+	if (code.g == ENTITY_TYPE_COLLECTABLE && all(greaterThanEqual(p, vec2(6.0))) && all(lessThan(p, vec2(10.0))))
+		color = collectable_color;
+
+	FragColor = color;
+}
@@ -0,0 +1,12 @@
+// #version and the Globals block come from shader_header in main.c
+layout (location = 0) in vec3 pos;
+
+uniform mat4 model;
+
+out vec2 board_pos;
+
+void main() {
+	// the square is -0.5..0.5 and the board is 8x8 tiles
+	board_pos = (pos.xy + 0.5) * 8.0;
+	gl_Position = projection * model * vec4(pos, 1.0);
+}
@@ -1 +1,3 @@
-gcc main.c ./deps/src/glad.c -I./deps/include -L./deps/lib -lglfw3dll
+gcc embed.c -o embed.exe
+embed.exe shader.vert shader.frag board.vert board.frag line.vert line.geom line.frag level1.dat level2.dat level3.dat level4.dat level5.dat level6.dat level7.dat level8.dat > assets.h
+gcc main.c ./deps/src/glad.c -I./deps/include -L./deps/lib -lglfw3dll -lpthread
@@ -2,3 +2,8 @@
 del a.exe
 del a.out
 del glad.o
+del embed.exe
+del assets.h
+del glgen.exe
+del gl_loader.h
+del program-*.bin
@@ -0,0 +1,35 @@
+// turns asset files into a header of byte arrays plus a table of them, so
+// the game starts without reading shaders or levels from disk. the table is
+// searched by load_asset in main.c, which expects the Asset typedef
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char **argv) {
+	printf("// generated by embed.c from the asset list in the Makefile, do not edit\n\n");
+
+	for (int i = 1; i < argc; ++i) {
+		FILE *fp = fopen(argv[i], "rb");
+		if (!fp) {
+			fprintf(stderr, "Can't read %s\n", argv[i]);
+			return 1;
+		}
+		printf("static const char asset_%d[] = {", i);
+		int c;
+		long size = 0;
+		while ((c = fgetc(fp)) != EOF) {
+			printf("%s0x%02x,", size % 16 == 0 ? "\n\t" : " ", c);
+			++size;
+		}
+		// read as text, so always terminated
+		printf("\n\t0x00\n};\n\n");
+		fclose(fp);
+	}
+
+	printf("static const Asset assets[] = {\n");
+	for (int i = 1; i < argc; ++i)
+		printf("\t{ \"%s\", asset_%d, sizeof(asset_%d) - 1 },\n", argv[i], i, i);
+	printf("};\n");
+
+	return 0;
+}
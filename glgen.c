@@ -0,0 +1,160 @@
+// writes a gl loader for just the functions a source file uses, instead of
+// the thousands glad.c resolves. every gl* identifier in the sources that
+// glad.h has a function typedef for gets a pointer, loaded eagerly by
+// gl_load. a pointer that can't be loaded then is left on a stub that
+// tries again on the first call. see load_gl in main.c
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_FUNCTIONS 512
+
+static char *read_file(const char *path) {
+	FILE *fp = fopen(path, "rb");
+	if (!fp) {
+		fprintf(stderr, "Can't read %s\n", path);
+		exit(1);
+	}
+	fseek(fp, 0, SEEK_END);
+	long length = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	char *buffer = malloc(length + 1);
+	if (!buffer || fread(buffer, 1, length, fp) != (size_t)length) {
+		fprintf(stderr, "Can't read %s\n", path);
+		exit(1);
+	}
+	buffer[length] = 0;
+	fclose(fp);
+	return buffer;
+}
+
+static int compare_names(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// the last identifier in a parameter, "const GLchar *const*string" -> "string"
+static void parameter_name(char *name, const char *start, const char *end) {
+	while (end > start && !isalnum((unsigned char)end[-1]) && end[-1] != '_')
+		--end;
+	const char *begin = end;
+	while (begin > start && (isalnum((unsigned char)begin[-1]) || begin[-1] == '_'))
+		--begin;
+	memcpy(name, begin, end - begin);
+	name[end - begin] = 0;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		fprintf(stderr, "Usage: glgen <glad.h> <sources...>\n");
+		return 1;
+	}
+	char *header = read_file(argv[1]);
+
+	char *names[MAX_FUNCTIONS];
+	int count = 0;
+	for (int i = 2; i < argc; ++i) {
+		char *source = read_file(argv[i]);
+		// every identifier, so gl inside a longer name never matches
+		for (char *c = source; *c;) {
+			if (!isalpha((unsigned char)*c) && *c != '_') {
+				++c;
+				continue;
+			}
+			char *end = c;
+			while (isalnum((unsigned char)*end) || *end == '_')
+				++end;
+			if (end - c > 2 && c[0] == 'g' && c[1] == 'l' && isupper((unsigned char)c[2])) {
+				int length = (int)(end - c);
+				int seen = 0;
+				for (int j = 0; j < count; ++j)
+					seen |= strncmp(names[j], c, length) == 0 && names[j][length] == 0;
+				if (!seen && count < MAX_FUNCTIONS) {
+					names[count] = malloc(length + 1);
+					memcpy(names[count], c, length);
+					names[count++][length] = 0;
+				}
+			}
+			c = end;
+		}
+		free(source);
+	}
+	qsort(names, count, sizeof(names[0]), compare_names);
+
+	printf("// generated by glgen.c from the gl calls in the sources, do not edit\n\n");
+	printf("static GLADloadproc gl_loader_proc;\n\n");
+	printf("static void *gl_resolve(const char *name) {\n");
+	printf("\tvoid *function = gl_loader_proc ? gl_loader_proc(name) : NULL;\n");
+	printf("\tif (!function) {\n");
+	printf("\t\tfprintf(stderr, \"Error: Missing GL function %%s\\n\", name);\n");
+	printf("\t\texit(-1);\n");
+	printf("\t}\n");
+	printf("\treturn function;\n");
+	printf("}\n\n");
+
+	char *loaded[MAX_FUNCTIONS];
+	int loaded_count = 0;
+	for (int i = 0; i < count; ++i) {
+		char proc[256] = "PFN";
+		int length = strlen(names[i]);
+		if (length > 200)
+			continue;
+		for (int j = 0; j <= length; ++j)
+			proc[3 + j] = toupper((unsigned char)names[i][j]);
+		strcat(proc, "PROC)(");
+
+		// typedef RETURN (APIENTRYP PFNGLNAMEPROC)(PARAMETERS);
+		char *match = strstr(header, proc);
+		if (!match)
+			continue;
+		char *line = match;
+		while (line > header && line[-1] != '\n')
+			--line;
+		if (strncmp(line, "typedef ", 8) != 0)
+			continue;
+		char *return_end = strstr(line, " (APIENTRYP ");
+		char *parameters = match + strlen(proc);
+		char *parameters_end = strstr(parameters, ");");
+		if (!return_end || return_end > match || !parameters_end)
+			continue;
+		int return_length = (int)(return_end - line - 8);
+		int void_return = return_length == 4 && strncmp(line + 8, "void", 4) == 0;
+		int parameters_length = (int)(parameters_end - parameters);
+		proc[strlen(proc) - 2] = 0;
+
+		printf("static %.*s APIENTRY lazy_%s(%.*s) {\n", return_length, line + 8, names[i], parameters_length, parameters);
+		printf("\tvoid *function = gl_resolve(\"%s\");\n", names[i]);
+		printf("\t*(void **)&glad_%s = function;\n", names[i]);
+		printf("\t%sglad_%s(", void_return ? "" : "return ", names[i]);
+		if (strncmp(parameters, "void)", 5) != 0) {
+			const char *start = parameters;
+			for (;;) {
+				const char *comma = memchr(start, ',', parameters_end - start);
+				const char *end = comma ? comma : parameters_end;
+				char name[128];
+				parameter_name(name, start, end);
+				printf("%s%s", name, comma ? ", " : "");
+				if (!comma)
+					break;
+				start = comma + 1;
+			}
+		}
+		printf(");\n}\n");
+		printf("%s glad_%s = lazy_%s;\n\n", proc, names[i], names[i]);
+		loaded[loaded_count++] = names[i];
+	}
+
+	printf("static int gl_load(GLADloadproc load) {\n");
+	printf("\tgl_loader_proc = load;\n");
+	printf("\tvoid *function;\n");
+	for (int i = 0; i < loaded_count; ++i) {
+		printf("\tif ((function = load(\"%s\")))\n", loaded[i]);
+		printf("\t\t*(void **)&glad_%s = function;\n", loaded[i]);
+	}
+	printf("\treturn 1;\n");
+	printf("}\n");
+
+	fprintf(stderr, "glgen: %d gl functions\n", loaded_count);
+	return 0;
+}
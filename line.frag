@@ -0,0 +1,8 @@
+// #version and the Globals block come from shader_header in main.c
+out vec4 FragColor;
+
+uniform vec4 color;
+
+void main() {
+	FragColor = color;
+}
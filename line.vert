@@ -0,0 +1,7 @@
+// #version and the Globals block come from shader_header in main.c
+layout (location = 0) in vec2 pos;
+
+void main() {
+	// still in game pixels, line.geom projects
+	gl_Position = vec4(pos, 0.0, 1.0);
+}
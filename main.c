@@ -1,8 +1,36 @@
+#define _POSIX_C_SOURCE 200809L
+// syscall, for perf_event_open
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __linux__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+// sysconf's processor count isn't there on mingw
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -18,23 +46,26 @@
  * [X] A pushes B
  * [X] A pulls B when > 2
  * [X] level transition
- * [ ] simple animation when moving
+ * [X] simple animation when moving
  * [?] ingegrate audio library - check previous commits for audio
  * tiles
  * [X] normal (no special properties)
  * [X] wall (cannot walk through, string must go around)
  * [X] water (A dies when walking in, B can be pushed in)
  * [X] block (can be pushed into water to create a path)
- * [/] ice (entity slides across) - check previous commits for ice
- * [ ] deep-snow / quick-sand (can push B through, can't pull B out)
+ * [X] ice (entity slides across)
+ * [X] deep-snow / quick-sand (can push B through, can't pull B out)
  */
 
 #define u8 uint8_t
 #define u16 uint16_t
 #define u32 uint32_t
+#define u64 uint64_t
 #define f32 float
 #define f64 double
+#define i8 int8_t
 #define i32 int32_t
+#define i64 int64_t
 
 #define LEFT 0
 #define RIGHT 1
@@ -45,6 +76,33 @@
 #define WIDTH 384
 #define HEIGHT 216
 
+// must be a power of two
+#define INPUT_QUEUE_SIZE 64
+#define STATE_BUFFER_FRESH 4
+// seconds each move takes to animate. moves queued meanwhile wait their turn
+#define MOVE_DURATION 0.1
+#define GLOBALS_BINDING 0
+#define STREAM_FRAMES 3
+#define STREAM_REGION_SIZE (64 * 1024)
+#define BATCH_VERTICES (6 * 256)
+#define PROGRAM_COUNT 3
+// the frame a new level first shows on may take this long, two frames at 60hz
+#define TRANSITION_BUDGET_MS 33.3
+// frames the hud percentiles and graph cover
+#define FRAME_STATS_WINDOW 256
+// timer queries in flight, read back this many frames later so they never wait
+#define FRAME_QUERIES 4
+#define HUD_GRAPH_FRAMES 128
+#define HUD_GRAPH_HEIGHT 32
+#define HUD_BAR_HEIGHT 2
+#define LATENCY_BUCKET_MS 2
+#define LATENCY_BUCKETS 50
+#define BENCH_COUNTERS 5
+#define REPLAY_FPS 60
+#define REPLAY_HOLD_FRAMES 30
+// more than one move can make, see try_move
+#define MOVE_EVENTS 12
+
 #define BOARD_TILE_SIZE 16
 #define BOARD_OFFSET_X WIDTH / 2 - 4 * BOARD_TILE_SIZE
 #define BOARD_OFFSET_Y HEIGHT / 2 - 4 * BOARD_TILE_SIZE
@@ -62,25 +120,24 @@ typedef enum tile_type {
 	TILE_TYPE_NORMAL,
 	TILE_TYPE_WALL,
 	TILE_TYPE_WATER,
-	TILE_TYPE_GOAL
+	TILE_TYPE_GOAL,
+	TILE_TYPE_ICE,
+	TILE_TYPE_SNOW
 } Tile_Type;
 
+#define ENTITY_TYPES 6
+#define TILE_TYPES 6
+// a tile as one number, type and entity, for the move rules. the last
+// code is off the board or behind a wall
+#define TILE_CODES (TILE_TYPES * ENTITY_TYPES + 1)
+#define TILE_CODE_BLOCKED (TILE_CODES - 1)
+
 typedef struct tile {
 	Tile_Type type;
 	u32 flags;
 	Entity_Type entity;
 } Tile;
 
-typedef struct queue_item Queue_Item;
-struct queue_item {
-	Queue_Item *next;
-	int data;
-};
-
-typedef struct {
-	Queue_Item *head;
-} Queue;
-
 typedef struct bfs_result {
 	int start;
 	int found;
@@ -102,15 +159,334 @@ typedef struct state {
 	bool exit_open;
 } State;
 
+typedef enum move_result {
+	MOVE_RESULT_NONE,
+	MOVE_RESULT_LEVEL_COMPLETE,
+	MOVE_RESULT_DIED
+} Move_Result;
+
+// everything a move can do, see move_actions
+typedef enum move_action_id {
+	MOVE_ACTION_NONE,
+	MOVE_ACTION_EXIT,
+	MOVE_ACTION_STEP,
+	MOVE_ACTION_STEP_COLLECT,
+	MOVE_ACTION_RIDE,
+	MOVE_ACTION_PUSH_B,
+	MOVE_ACTION_PUSH_BLOCK,
+	MOVE_ACTION_SINK_BLOCK,
+	MOVE_ACTION_LEAVE_B,
+	MOVE_ACTION_LEAVE_B_COLLECT,
+	MOVE_ACTION_LEAVE_B_PUSH_BLOCK,
+	MOVE_ACTION_LEAVE_B_SINK_BLOCK,
+	MOVE_ACTIONS
+} Move_Action_Id;
+
+// what one move does to the tile A leaves (from), the one it moves to
+// (target) and the one after that (beyond), and where A and B end up.
+// MOVE_KEEP leaves a field as it was
+#define MOVE_KEEP 0xff
+#define MOVE_AT_START 0
+#define MOVE_AT_TARGET 1
+#define MOVE_AT_BEYOND 2
+typedef struct move_action {
+	u8 from_entity;
+	u8 target_entity;
+	u8 beyond_entity;
+	u8 beyond_type;
+	u8 a_to;
+	u8 b_to;
+	u8 collect;
+	u8 result;
+} Move_Action;
+
+// what a move changed, so nothing has to diff two States to find out.
+// from and to are tile indices, value is what the event is about:
+//  MOVED          an entity (A, B or a block) went from -> to
+//  TILE           the tile at to became type value (water filled in)
+//  COLLECTED      the collectable at to was picked up
+//  EXIT_OPENED    that was the last one
+//  CHAIN          link value of the chain went from -> to, -1 when hidden
+//  DIED, RESTARTED, LEVEL_COMPLETE
+//                 the level gets (re)loaded. player_move drops everything
+//                 else then, the new state is all that matters
+typedef enum move_event_type {
+	MOVE_EVENT_MOVED,
+	MOVE_EVENT_TILE,
+	MOVE_EVENT_COLLECTED,
+	MOVE_EVENT_EXIT_OPENED,
+	MOVE_EVENT_CHAIN,
+	MOVE_EVENT_DIED,
+	MOVE_EVENT_RESTARTED,
+	MOVE_EVENT_LEVEL_COMPLETE
+} Move_Event_Type;
+
+typedef struct move_event {
+	u8 type;
+	u8 value;
+	i8 from;
+	i8 to;
+} Move_Event;
+
+typedef struct move_events {
+	u32 count;
+	Move_Event events[MOVE_EVENTS];
+} Move_Events;
+
+// time is when the key went down. the rest is only filled in for the
+// latency trace, see update
+typedef struct input_event {
+	int direction;
+	f64 time;
+	f64 move_start;
+	f64 move_end;
+	u32 revision;
+} Input_Event;
+
+// single producer (key_callback) / single consumer (update) ring. head and
+// tail only ever count up, the difference is how many events are waiting
+typedef struct input_queue {
+	Input_Event events[INPUT_QUEUE_SIZE];
+	atomic_uint head;
+	atomic_uint tail;
+	u32 dropped;
+} Input_Queue;
+
+// what the renderer needs to animate the latest move
+typedef struct snapshot {
+	State current;
+	Move_Events events;
+	f64 move_time;
+	u32 revision;
+} Snapshot;
+
+// the simulation thread fills back, the render thread reads front and
+// finished snapshots are handed over by swapping through middle, so neither
+// side ever waits on the other
+typedef struct state_buffer {
+	Snapshot slots[3];
+	atomic_uint middle;
+	u32 back;
+	u32 front;
+} State_Buffer;
+
+typedef struct static_layer_key {
+	u8 codes[64][2];
+	int collected;
+	int collectable_count;
+	bool exit_open;
+} Static_Layer_Key;
+
+// snow has a bit per deep-snow tile, B can't be pulled out of those
+typedef struct level_analysis {
+	u8 push_mask[64];
+	u64 snow;
+} Level_Analysis;
+
+// where something on ice ends up, per tile and direction. only walls, tile
+// types and the entities that stay put (blocks, collectables) go into it,
+// so whatever moves a block, takes a collectable or swaps in another state
+// clears valid. A and B are checked on the way, see slide_end
+typedef struct slide_table {
+	bool valid;
+	u8 ends[64][4];
+} Slide_Table;
+
+// what the driver has bound right now, so binding it again can be skipped.
+// calls counts every gl call the render thread makes, draws and uniforms
+// the draw calls and uniform uploads among them, all reset each frame
+typedef struct render_cache {
+	u32 program;
+	u32 vertex_array;
+	u32 texture;
+	u32 read_framebuffer;
+	u32 draw_framebuffer;
+	u32 calls;
+	u32 draws;
+	u32 uniforms;
+	u64 total_calls;
+	u64 frames;
+} Render_Cache;
+
+// per-frame vertices are uploaded into one region of a ring of
+// STREAM_FRAMES, and a region is only reused once the fence from the frame
+// that last drew from it has passed, so uploads never wait on the gpu
+typedef struct stream_buffer {
+	u32 vbo;
+	u32 region;
+	u32 offset;
+	GLsync fences[STREAM_FRAMES];
+	u64 stalls;
+	u64 orphans;
+} Stream_Buffer;
+
+typedef struct batch_vertex {
+	f32 x, y;
+	u8 color[4];
+} Batch_Vertex;
+
+// std140 layout of the Globals block in the shaders, uploaded once
+typedef struct globals_block {
+	mat4x4 projection;
+	vec4 outline_color;
+	vec4 fill_color;
+	vec4 wall_color;
+	vec4 water_color;
+	vec4 goal_color;
+	vec4 collectable_color;
+	vec4 ice_color;
+	vec4 snow_color;
+} Globals_Block;
+
+// goes in front of every shader, so the #version line and the Globals block
+// that has to match Globals_Block are only written down once
+static const char shader_header[] =
+	"#version 330 core\n"
+	"layout (std140) uniform Globals {\n"
+	"	mat4 projection;\n"
+	"	vec4 outline_color;\n"
+	"	vec4 fill_color;\n"
+	"	vec4 wall_color;\n"
+	"	vec4 water_color;\n"
+	"	vec4 goal_color;\n"
+	"	vec4 collectable_color;\n"
+	"	vec4 ice_color;\n"
+	"	vec4 snow_color;\n"
+	"};\n";
+
+// a level as it starts, see prepare_level
+typedef struct prepared_level {
+	State state;
+	Level_Analysis analysis;
+	bool ready;
+} Prepared_Level;
+
+// the level after the current one, prepared on a thread while the current
+// one is played, see start_prefetch
+typedef struct level_prefetch {
+	pthread_t thread;
+	bool running;
+	int index;
+	Prepared_Level level;
+} Level_Prefetch;
+
+// one frame, times in ms. gpu_ms is -1 when it isn't known
+typedef struct frame_sample {
+	f64 cpu_ms;
+	f64 swap_ms;
+	f64 gpu_ms;
+	u32 calls;
+	u32 draws;
+	u32 uniforms;
+	u32 moves;
+	u32 bfs_runs;
+} Frame_Sample;
+
+// the last FRAME_STATS_WINDOW frames, for the hud (F3) and the frame log
+// written by "stats <log.csv|log.json>". gpu times come from GL_TIME_ELAPSED
+// queries if the driver has a timer for them
+typedef struct frame_stats {
+	bool hud;
+	FILE *log;
+	bool json;
+	Frame_Sample samples[FRAME_STATS_WINDOW];
+	u64 count;
+	bool timer_queries;
+	bool query_active;
+	u32 queries[FRAME_QUERIES];
+	u64 query_frames[FRAME_QUERIES];
+	f64 query_starts[FRAME_QUERIES];
+	bool query_pending[FRAME_QUERIES];
+	u32 last_moves;
+	u32 last_bfs_runs;
+	f64 percentile_time;
+	f64 cpu_percentiles[3];
+	f64 gpu_percentiles[3];
+} Frame_Stats;
+
+typedef enum latency_stage {
+	LATENCY_QUEUE,
+	LATENCY_MOVE,
+	LATENCY_WAIT,
+	LATENCY_FRAME,
+	LATENCY_TOTAL,
+	LATENCY_STAGES
+} Latency_Stage;
+
+// key down to the return of the swap that first showed the move, split
+// into waiting for the simulation, the move itself, waiting for a frame
+// to start and that frame. "latency" turns it on. the simulation thread
+// sends every move it played back through trace_queue
+typedef struct latency_stats {
+	bool enabled;
+	Input_Event pending;
+	bool has_pending;
+	u32 counts[LATENCY_STAGES][LATENCY_BUCKETS];
+	u32 inputs;
+} Latency_Stats;
+
+// read on a thread while the window is being created, see start_preload
+typedef struct preload {
+	pthread_t thread;
+	bool running;
+	char cache_paths[PROGRAM_COUNT][64];
+	u8 *cache_files[PROGRAM_COUNT];
+	long cache_sizes[PROGRAM_COUNT];
+} Preload;
+
+// a file built into the binary, see embed.c
+typedef struct asset {
+	const char *name;
+	const char *data;
+	u32 size;
+} Asset;
+
+#include "assets.h"
+
+// make loader=trimmed, see glgen.c
+#ifdef TRIMMED_GL
+#include "gl_loader.h"
+#endif
+
 static GLFWwindow *window;
 static u32 shader;
+static u32 board_shader;
+static u32 line_shader;
+static u32 board_texture;
+static u32 globals_ubo;
+static int exit_open_location;
+static Render_Cache render_cache;
+static Frame_Stats frame_stats;
+static f64 startup_time;
+static f64 gl_load_time;
+static Preload preload;
+// vertex, geometry or NULL, and fragment shader of each program
+static const char *program_paths[PROGRAM_COUNT][3] = {
+	{ "shader.vert", NULL, "shader.frag" },
+	{ "board.vert", NULL, "board.frag" },
+	{ "line.vert", "line.geom", "line.frag" },
+};
+static Stream_Buffer stream;
+static u32 batch_vao;
+static Batch_Vertex batch[BATCH_VERTICES];
+static u32 batch_count;
+static u32 static_fbo;
+static u32 static_texture;
+static u32 static_layer_revision;
+static bool static_layer_valid;
+static Static_Layer_Key static_layer_key;
+static u32 scene_fbo;
+static u32 scene_texture;
+static int present_x;
+static int present_y;
+static int present_width = WIDTH * SCALE;
+static int present_height = HEIGHT * SCALE;
 static u32 square_vao;
 static u32 square_vbo;
 static u32 square_ebo;
 static u32 line_vao;
-static u32 line_vbo;
 static mat4x4 projection;
-static const char *levels[] = { "level1.dat", "level2.dat", "level3.dat", "level4.dat", "level5.dat" , "level6.dat" };
+static const char *levels[] = { "level1.dat", "level2.dat", "level3.dat", "level4.dat", "level5.dat" , "level6.dat", "level7.dat", "level8.dat" };
 
 static vec4 color_white = {1.0f, 1.0f, 1.0f, 1.0f};
 static vec4 color_bg = {0.2f, 0.0f, 0.2f, 1.0f};
@@ -122,40 +498,175 @@ static vec4 color_orange = {1.0f, 0.55f, 0.1f, 1.0f};
 static vec4 color_salmon = {1.0f, 0.24f, 0.24f, 1.0f};
 static vec4 color_green = {0.0f, 1.0f, 0.0f, 1.0f};
 static vec4 color_goal = {0.9f, 0.9f, 0.0f, 1.0f};
+static vec4 color_ice = {0.55f, 0.75f, 0.85f, 1.0f};
+static vec4 color_snow = {0.42f, 0.38f, 0.32f, 1.0f};
 
 static State state = {0};
+static Level_Analysis level_analysis = {0};
+static Slide_Table slides = {0};
+static const int direction_steps[4] = { -1, 1, 8, -8 };
+static Input_Queue input_queue = {0};
+static Input_Queue trace_queue = {0};
+static Latency_Stats latency_stats = {0};
+static State_Buffer state_buffer = {0};
+static Prepared_Level level_start = {0};
+static Level_Prefetch prefetch = { .index = -1 };
+static f64 move_time = 0;
+static u32 state_revision = 0;
+static pthread_t simulation_thread;
+static sem_t input_ready;
+static atomic_bool simulation_quit;
+// counted for the frame stats, from whichever thread moves or searches
+static atomic_uint moves_made;
+static atomic_uint bfs_runs;
 
 static void error_and_exit(int error, const char *message) {
 	fprintf(stderr, "Error: %s\n", message);
 	exit(-1);
 }
 
-static Queue_Item *enqueue(Queue *queue) {
-	Queue_Item *item = malloc(sizeof(Queue_Item));
-	item->next = NULL;
-	if (queue->head == NULL) {
-		queue->head = item;
-	} else {
-		// expensive add cause i'm tired and stupid
-		Queue_Item *curr = queue->head;
-		while (curr->next != NULL) {
-			curr = curr->next;
-		}
-		curr->next = item;
-	}
-	return item;
+// make allocs=tracked: every malloc and free below goes through here and is
+// counted against the function that made it. a header in front of each
+// block remembers its size and site. allocations are also counted per
+// thread, which is how render and update get per-frame and per-move counts
+#ifdef TRACK_ALLOCATIONS
+#define ALLOCATION_SITES 32
+
+typedef struct allocation_site {
+	const char *name;
+	u64 count;
+	u64 bytes;
+	i64 live_count;
+	i64 live_bytes;
+} Allocation_Site;
+
+typedef union allocation_header {
+	struct {
+		size_t size;
+		int site;
+	} block;
+	max_align_t align;
+} Allocation_Header;
+
+// allocations made per frame or per move
+typedef struct allocation_rate {
+	u64 samples;
+	u64 total;
+	u64 worst;
+} Allocation_Rate;
+
+typedef struct allocation_tracker {
+	pthread_mutex_t lock;
+	Allocation_Site sites[ALLOCATION_SITES];
+	int site_count;
+	i64 live_count;
+	i64 live_bytes;
+	i64 peak_bytes;
+	Allocation_Rate frames;
+	Allocation_Rate moves;
+} Allocation_Tracker;
+
+static Allocation_Tracker allocations = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static _Thread_local u64 thread_allocations;
+
+static void *tracked_malloc(size_t size, const char *site_name) {
+	Allocation_Header *header = malloc(sizeof(Allocation_Header) + size);
+	if (!header)
+		return NULL;
+	pthread_mutex_lock(&allocations.lock);
+	// __func__ is one array per function, so its address names the site
+	int site = 0;
+	while (site < allocations.site_count && allocations.sites[site].name != site_name)
+		++site;
+	if (site == allocations.site_count && site < ALLOCATION_SITES)
+		allocations.sites[allocations.site_count++].name = site_name;
+	if (site == ALLOCATION_SITES)
+		site = ALLOCATION_SITES - 1;
+	Allocation_Site *counts = &allocations.sites[site];
+	++counts->count;
+	counts->bytes += size;
+	++counts->live_count;
+	counts->live_bytes += size;
+	++allocations.live_count;
+	allocations.live_bytes += size;
+	if (allocations.live_bytes > allocations.peak_bytes)
+		allocations.peak_bytes = allocations.live_bytes;
+	pthread_mutex_unlock(&allocations.lock);
+
+	++thread_allocations;
+	header->block.size = size;
+	header->block.site = site;
+	return header + 1;
+}
+
+static void tracked_free(void *pointer) {
+	if (!pointer)
+		return;
+	Allocation_Header *header = (Allocation_Header *)pointer - 1;
+	pthread_mutex_lock(&allocations.lock);
+	Allocation_Site *counts = &allocations.sites[header->block.site];
+	--counts->live_count;
+	counts->live_bytes -= header->block.size;
+	--allocations.live_count;
+	allocations.live_bytes -= header->block.size;
+	pthread_mutex_unlock(&allocations.lock);
+	free(header);
 }
 
+static void count_allocations(Allocation_Rate *rate, u64 made) {
+	pthread_mutex_lock(&allocations.lock);
+	++rate->samples;
+	rate->total += made;
+	if (made > rate->worst)
+		rate->worst = made;
+	pthread_mutex_unlock(&allocations.lock);
+}
 
-static Queue_Item *dequeue(Queue *queue) {
-	if (queue->head == NULL) {
-		return NULL;
+static void count_frame_allocations(u64 made) {
+	count_allocations(&allocations.frames, made);
+}
+
+static void count_move_allocations(u64 made) {
+	count_allocations(&allocations.moves, made);
+}
+
+static i64 live_allocations() {
+	pthread_mutex_lock(&allocations.lock);
+	i64 live = allocations.live_count;
+	pthread_mutex_unlock(&allocations.lock);
+	return live;
+}
+
+static void print_allocation_rate(const char *name, const Allocation_Rate *rate) {
+	if (rate->samples == 0)
+		return;
+	printf("  per %s: %.2f on average, %llu at worst, over %llu\n", name, (f64)rate->total / rate->samples,
+		(unsigned long long)rate->worst, (unsigned long long)rate->samples);
+}
+
+// at exit, anything still live here is a leak or something kept for good
+static void print_allocations() {
+	printf("allocations: %lld live, %lld bytes, %lld bytes at peak\n", (long long)allocations.live_count,
+		(long long)allocations.live_bytes, (long long)allocations.peak_bytes);
+	print_allocation_rate("frame", &allocations.frames);
+	print_allocation_rate("move", &allocations.moves);
+	for (int i = 0; i < allocations.site_count; ++i) {
+		const Allocation_Site *site = &allocations.sites[i];
+		printf("  %-24s %10llu allocations %12llu bytes, %lld live %lld bytes\n", site->name,
+			(unsigned long long)site->count, (unsigned long long)site->bytes,
+			(long long)site->live_count, (long long)site->live_bytes);
 	}
-	Queue_Item *temp = queue->head;
-	queue->head = queue->head->next;
-	return temp;
 }
 
+#define malloc(size) tracked_malloc(size, __func__)
+#define free(pointer) tracked_free(pointer)
+#else
+static u64 thread_allocations;
+static void count_frame_allocations(u64 made) {}
+static void count_move_allocations(u64 made) {}
+static i64 live_allocations() { return 0; }
+#endif
+
 static char *read_file_into_buffer(const char *path) {
 	FILE *fp = fopen(path, "rb");
 	if (!fp)
@@ -172,6 +683,30 @@ static char *read_file_into_buffer(const char *path) {
 	return buffer;
 }
 
+// built in copy if there is one, otherwise off the disk
+static const char *load_asset(const char *path) {
+	for (u32 i = 0; i < sizeof(assets) / sizeof(assets[0]); ++i) {
+		if (strcmp(assets[i].name, path) == 0)
+			return assets[i].data;
+	}
+	return read_file_into_buffer(path);
+}
+
+// frees what load_asset read off the disk, built in copies stay
+static void release_asset(const char *data) {
+	for (u32 i = 0; i < sizeof(assets) / sizeof(assets[0]); ++i) {
+		if (assets[i].data == data)
+			return;
+	}
+	free((char *)data);
+}
+
+static f64 now_ms() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
 static void get_neighbours(int *n, int index, int direction) {
 	if (direction == LEFT || direction == RIGHT) {
 		n[3] = index % 8 ? index - 1 : -1;
@@ -186,30 +721,79 @@ static void get_neighbours(int *n, int index, int direction) {
 	}
 }
 
-static BFS_Result bfs(int start, int goal, int direction) {
+static int can_move_on(const State *s, int direction, int index) {
+	switch (direction) {
+	case LEFT: {
+		if (index % 8 == 0)
+			break;
+		const Tile *left_tile = &s->tiles[index-1];
+		if (left_tile->type == TILE_TYPE_WALL)
+			break;
+		return index - 1;
+	} break;
+	case RIGHT: {
+		if (index % 8 == 7)
+			break;
+		const Tile *right_tile = &s->tiles[index+1];
+		if (right_tile->type == TILE_TYPE_WALL)
+			break;
+		return index + 1;
+	} break;
+	case UP: {
+		if (index >= 56)
+			break;
+		const Tile *up_tile = &s->tiles[index+8];
+		if (up_tile->type == TILE_TYPE_WALL)
+			break;
+		return index + 8;
+	} break;
+	case DOWN: {
+		if (index <= 7)
+			break;
+		const Tile *down_tile = &s->tiles[index-8];
+		if (down_tile->type == TILE_TYPE_WALL)
+			break;
+		return index - 8;
+	} break;
+	}
+
+	return -1;
+}
+
+static int can_move(int direction, int index) {
+	return can_move_on(&state, direction, index);
+}
+
+// cleared has a bit for each tile a move is about to take a block off, and
+// block_to is where it puts one down, -1 if nowhere, so a move's chain can
+// be traced before the move is made
+static BFS_Result bfs_moved(State *s, int start, int goal, int direction, u64 cleared, int block_to) {
 	BFS_Result result = {-1};
 	result.start = start;
-	Queue q = {0};
-	Queue_Item *q_item = enqueue(&q);
-	q_item->data = start;
+	result.found = -1;
+	// every tile goes in at most once, start included, so 64 is enough
+	int queue[64];
+	int head = 0, tail = 0;
+	atomic_fetch_add_explicit(&bfs_runs, 1, memory_order_relaxed);
+	queue[tail++] = start;
 	memset(result.came_from, -1, 64 * sizeof(int));
+	result.came_from[start] = start;
 
-	while (q.head != NULL) {
-		Queue_Item *item = dequeue(&q);
+	while (head < tail) {
+		int current = queue[head++];
 		int neighbours[4];
-		get_neighbours(neighbours, item->data, direction);
+		get_neighbours(neighbours, current, direction);
 		for (int i = 0; i < 4; ++i) {
 			int index = neighbours[i];
 			if (index == -1)
 				continue;
-			if (state.tiles[index].type == TILE_TYPE_WALL)
+			if (s->tiles[index].type == TILE_TYPE_WALL)
 				continue;
-			if (state.tiles[index].entity == ENTITY_TYPE_BLOCK)
+			if (index == block_to || (s->tiles[index].entity == ENTITY_TYPE_BLOCK && !(cleared >> index & 1)))
 				continue;
 			if (result.came_from[index] == -1) {
-				Queue_Item *new_item = enqueue(&q);
-				new_item->data = index;
-				result.came_from[index] = item->data;
+				queue[tail++] = index;
+				result.came_from[index] = current;
 			}
 			if (goal == index) {
 				result.found = index;
@@ -224,33 +808,175 @@ static BFS_Result bfs(int start, int goal, int direction) {
 		int current = goal;
 		while (current != start) {
 			++result.distance;
-			result.path[i++] = current;
+			if (i < 4)
+				result.path[i++] = current;
 			current = result.came_from[current];
 		}
 	}
 
-	memcpy(&state.last_bfs, &result, sizeof(BFS_Result));
+	memcpy(&s->last_bfs, &result, sizeof(BFS_Result));
 
 	return result;
 }
 
-static void load_level(int index) {
-	if (index == 6) {
-		printf("Thanks for playing!\n");
-		glfwSetWindowShouldClose(window, GLFW_TRUE);
+static BFS_Result bfs(State *s, int start, int goal, int direction) {
+	return bfs_moved(s, start, goal, direction, 0, -1);
+}
+
+static bool is_land(int index) {
+	Tile_Type type = state.tiles[index].type;
+	return type == TILE_TYPE_NORMAL || type == TILE_TYPE_GOAL || type == TILE_TYPE_ICE || type == TILE_TYPE_SNOW;
+}
+
+// walls never change, so which ways a block could ever be pushed from a tile
+// is worked out once per level. a push needs room for A behind the block and
+// somewhere for the block to go. snow never changes either
+static void analyse_level(const State *s, Level_Analysis *analysis) {
+	analysis->snow = 0;
+	for (int index = 0; index < 64; ++index) {
+		analysis->push_mask[index] = 0;
+		if (s->tiles[index].type == TILE_TYPE_SNOW)
+			analysis->snow |= (u64)1 << index;
+		if (s->tiles[index].type == TILE_TYPE_WALL)
+			continue;
+		for (int direction = LEFT; direction <= DOWN; ++direction) {
+			// LEFT/RIGHT and UP/DOWN are pairs, so ^ 1 flips the direction
+			if (can_move_on(s, direction ^ 1, index) >= 0 && can_move_on(s, direction, index) >= 0)
+				analysis->push_mask[index] |= 1 << direction;
+		}
+	}
+}
+
+// a block that can't be pushed along either axis stays put for good, unless
+// A rides B on neighbouring water and steps straight onto it
+static bool is_frozen_block(int index) {
+	if (state.tiles[index].entity != ENTITY_TYPE_BLOCK)
+		return false;
+	if (level_analysis.push_mask[index])
+		return false;
+	for (int direction = LEFT; direction <= DOWN; ++direction) {
+		int n = can_move(direction, index);
+		if (n >= 0 && state.tiles[n].type == TILE_TYPE_WATER)
+			return false;
+	}
+	return true;
+}
+
+// true when the current state can never reach an open goal. everything here
+// over-estimates what the player can still do (blocks pass through each other,
+// B is wherever it's needed, every block fills every water tile it can reach)
+// so a state is only reported dead when it really is. cheap enough to run
+// after every move, and search can use it to prune
+static bool is_dead_state() {
+	Entity_Type b = state.tiles[state.player_b_index].entity;
+	// B got squashed by a block
+	if (b != ENTITY_TYPE_PLAYER_B && b != ENTITY_TYPE_PLAYER_BOTH)
+		return true;
+
+	bool blocked[64];
+	for (int i = 0; i < 64; ++i) {
+		blocked[i] = state.tiles[i].type == TILE_TYPE_WALL || is_frozen_block(i);
+	}
+
+	// water some block can still be pushed into
+	bool fillable[64] = {0};
+	bool seen[64] = {0};
+	int queue[64];
+	int head = 0, tail = 0;
+	for (int i = 0; i < 64; ++i) {
+		if (state.tiles[i].entity == ENTITY_TYPE_BLOCK && !blocked[i]) {
+			seen[i] = true;
+			queue[tail++] = i;
+		}
+	}
+	while (head < tail) {
+		int current = queue[head++];
+		if (state.tiles[current].type == TILE_TYPE_WATER)
+			fillable[current] = true;
+		for (int direction = LEFT; direction <= DOWN; ++direction) {
+			if (!(level_analysis.push_mask[current] & 1 << direction))
+				continue;
+			int behind = can_move(direction ^ 1, current);
+			int next = can_move(direction, current);
+			if (blocked[behind] || blocked[next] || seen[next])
+				continue;
+			seen[next] = true;
+			queue[tail++] = next;
+		}
+	}
+
+	// A can only stand on water while riding B, and can't step from water
+	// to water without dying
+	bool reach_a[64] = {0};
+	head = tail = 0;
+	reach_a[state.player_a_index] = true;
+	queue[tail++] = state.player_a_index;
+	while (head < tail) {
+		int current = queue[head++];
+		bool from_land = is_land(current) || fillable[current];
+		for (int direction = LEFT; direction <= DOWN; ++direction) {
+			int next = can_move(direction, current);
+			if (next < 0 || blocked[next] || reach_a[next])
+				continue;
+			if (!from_land && !is_land(next) && !fillable[next])
+				continue;
+			reach_a[next] = true;
+			queue[tail++] = next;
+		}
+	}
+
+	bool reach_b[64] = {0};
+	head = tail = 0;
+	reach_b[state.player_b_index] = true;
+	queue[tail++] = state.player_b_index;
+	while (head < tail) {
+		int current = queue[head++];
+		for (int direction = LEFT; direction <= DOWN; ++direction) {
+			int next = can_move(direction, current);
+			if (next < 0 || blocked[next] || reach_b[next])
+				continue;
+			reach_b[next] = true;
+			queue[tail++] = next;
+		}
+	}
+
+	if (!state.exit_open) {
+		int remaining = 0;
+		for (int i = 0; i < 64; ++i) {
+			if (state.tiles[i].entity != ENTITY_TYPE_COLLECTABLE)
+				continue;
+			if (!reach_a[i])
+				return true;
+			++remaining;
+		}
+		// something landed on a collectable, so the exit can never open
+		if (state.collected + remaining < state.collectable_count)
+			return true;
+	}
+
+	for (int i = 0; i < 64; ++i) {
+		if (state.tiles[i].type == TILE_TYPE_GOAL && reach_a[i] && reach_b[i])
+			return false;
 	}
-	char *level_data = read_file_into_buffer(levels[index]);
 
-	state.level_index = index;
-	state.collectable_count = 0;
-	state.collected = 0;
-	state.exit_open = 0;
+	return true;
+}
+
+// parses a level and works out everything it starts with, into level
+// rather than state so it can run next to a game in progress
+static void parse_level(Prepared_Level *level, const char *level_data, int index) {
+	State *s = &level->state;
+
+	s->level_index = index;
+	s->collectable_count = 0;
+	s->collected = 0;
+	s->exit_open = 0;
 
 	for (int row = 0; row < 8; ++row) {
-		char *start = &level_data[row * 9];
+		const char *start = &level_data[row * 9];
 		for (int col = 0; col < 8; ++col) {
 			int index = (7 - row) * 8 + col;
-			Tile *tile = &state.tiles[index];
+			Tile *tile = &s->tiles[index];
 			tile->type = TILE_TYPE_NORMAL;
 			tile->entity = ENTITY_TYPE_NONE;
 			switch (start[col]) {
@@ -259,24 +985,28 @@ static void load_level(int index) {
 			case ' ': tile->type = TILE_TYPE_WATER; break;
 			case 'A': {
 				tile->entity = ENTITY_TYPE_PLAYER_A;
-				state.player_a_index = index;
+				s->player_a_index = index;
 			} break;
 			case 'B': {
 				tile->entity = ENTITY_TYPE_PLAYER_B;
-				state.player_b_index = index;
+				s->player_b_index = index;
 			} break;
 			case 'c': {
 				tile->entity = ENTITY_TYPE_COLLECTABLE;
-				++state.collectable_count;
+				++s->collectable_count;
 			} break;
 			case 'X': tile->type = TILE_TYPE_GOAL; break;
+			case '~': tile->type = TILE_TYPE_ICE; break;
+			case '*': tile->type = TILE_TYPE_SNOW; break;
 			case ':': tile->entity = ENTITY_TYPE_BLOCK; break;
 			}
 		}
 	}
 
+	analyse_level(s, &level->analysis);
+
 	// bfs to create chain
-	BFS_Result result = bfs(state.player_a_index, state.player_b_index, LEFT);
+	BFS_Result result = bfs(s, s->player_a_index, s->player_b_index, LEFT);
 
 	// somehow could not find B...
 	if (result.found == -1) {
@@ -286,151 +1016,401 @@ static void load_level(int index) {
 	int current = result.found;
 	int i = 2;
 
-	memset(state.chain_indices, -1, 2 * sizeof(int));
-	memset(state.chain_visible, 1, 2 * sizeof(int));
+	memset(s->chain_indices, -1, 2 * sizeof(int));
+	memset(s->chain_visible, 1, 2 * sizeof(int));
 
-	while (current != state.player_a_index) {
+	while (current != s->player_a_index) {
 		if (i <= 1 && i >= 0) {
-			state.chain_indices[i] = current;
+			s->chain_indices[i] = current;
 		}
 		current = result.came_from[current];
 		--i;
 	}
+	level->ready = true;
 }
 
-static void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
-	glViewport(0, 0, width, height);
+// one of the game's own levels, built in copy first
+static void prepare_level(Prepared_Level *level, const char *path, int index) {
+	const char *level_data = load_asset(path);
+	parse_level(level, level_data, index);
+	release_asset(level_data);
 }
 
-static int can_move(int direction, int index) {
-	switch (direction) {
-	case LEFT: {
-		if (index % 8 == 0)
-			break;
-		Tile *left_tile = &state.tiles[index-1];
-		if (left_tile->type == TILE_TYPE_WALL)
-			break;
-		return index - 1;
-	} break;
-	case RIGHT: {
-		if (index % 8 == 7)
-			break;
-		Tile *right_tile = &state.tiles[index+1];
-		if (right_tile->type == TILE_TYPE_WALL)
-			break;
-		return index + 1;
-	} break;
-	case UP: {
-		if (index >= 56)
-			break;
-		Tile *up_tile = &state.tiles[index+8];
-		if (up_tile->type == TILE_TYPE_WALL)
-			break;
-		return index + 8;
-	} break;
-	case DOWN: {
-		if (index <= 7)
-			break;
-		Tile *down_tile = &state.tiles[index-8];
-		if (down_tile->type == TILE_TYPE_WALL)
-			break;
-		return index - 8;
-	} break;
+// a level file named on the command line. always off the disk, so the
+// tools see a level as it was just edited and not as it was built in
+static void read_level_file(Prepared_Level *level, const char *path, int index) {
+	char *level_data = read_file_into_buffer(path);
+	parse_level(level, level_data, index);
+	free(level_data);
+}
+
+static void install_level(const Prepared_Level *level) {
+	memcpy(&state, &level->state, sizeof(State));
+	memcpy(&level_analysis, &level->analysis, sizeof(Level_Analysis));
+	slides.valid = false;
+}
+
+static void load_level_file(const char *path, int index) {
+	Prepared_Level level;
+	read_level_file(&level, path, index);
+	install_level(&level);
+}
+
+static void finish_prefetch() {
+	if (!prefetch.running)
+		return;
+	pthread_join(prefetch.thread, NULL);
+	prefetch.running = false;
+}
+
+static void *prefetch_main(void *data) {
+	prepare_level(&prefetch.level, levels[prefetch.index], prefetch.index);
+	return NULL;
+}
+
+// starts preparing a level on a thread, unless it already is. only called
+// by whoever owns state at the time, as is take_prefetched
+static void start_prefetch(int index) {
+	if (index >= (int)(sizeof(levels) / sizeof(levels[0])) || prefetch.index == index)
+		return;
+	finish_prefetch();
+	prefetch.index = index;
+	// not fatal, load_level just prepares it itself
+	if (pthread_create(&prefetch.thread, NULL, prefetch_main, NULL) != 0) {
+		prefetch.index = -1;
+		return;
 	}
+	prefetch.running = true;
+}
 
-	return -1;
+static bool take_prefetched(int index, Prepared_Level *level) {
+	if (prefetch.index != index)
+		return false;
+	finish_prefetch();
+	memcpy(level, &prefetch.level, sizeof(Prepared_Level));
+	return true;
 }
 
-// a lot of compression could be done here
-static void try_move(int direction, int index) {
-	int new_index = can_move(direction, index);
-	if (new_index >= 0) {
-		switch (state.tiles[index].entity) {
-		case ENTITY_TYPE_PLAYER_A: {
-			if (state.tiles[new_index].entity == ENTITY_TYPE_COLLECTABLE) {
-				++state.collected;
-				if (state.collected == state.collectable_count) {
-					state.exit_open = true;
-				}
-			}
-			// if pushing B
-			if (state.tiles[new_index].entity == ENTITY_TYPE_PLAYER_B) {
-				// if riding B
-				if (state.tiles[new_index].type == TILE_TYPE_WATER) {
-					state.tiles[new_index].entity = ENTITY_TYPE_PLAYER_BOTH;
-					state.tiles[index].entity = ENTITY_TYPE_NONE;
-					state.player_a_index = new_index;
-					state.player_b_index = new_index;
-				} else if (state.tiles[new_index].type == TILE_TYPE_GOAL && state.exit_open) {
-					load_level(state.level_index + 1);
-				} else {
-					int new_b_index = can_move(direction, new_index);
-					if (new_b_index >= 0) {
-						if (state.tiles[new_b_index].entity == ENTITY_TYPE_BLOCK) {
-							break;
-						}
-						state.tiles[new_b_index].entity = ENTITY_TYPE_PLAYER_B;
-						state.player_b_index = new_b_index;
-						state.tiles[new_index].entity = ENTITY_TYPE_PLAYER_A;
-						state.tiles[index].entity = ENTITY_TYPE_NONE;
-						state.player_a_index = new_index;
-					}
-				}
-			// pushing a block
-			} else if (state.tiles[new_index].entity == ENTITY_TYPE_BLOCK) {
-				int new_block_index = can_move(direction, new_index);
-				if (new_block_index >= 0) {
-					if (state.tiles[new_block_index].type == TILE_TYPE_WATER)
-						state.tiles[new_block_index].type = TILE_TYPE_NORMAL;
-					else
-						state.tiles[new_block_index].entity = ENTITY_TYPE_BLOCK;
-					state.tiles[new_index].entity = ENTITY_TYPE_PLAYER_A;
-					state.tiles[index].entity = ENTITY_TYPE_NONE;
-					state.player_a_index = new_index;
-				}
-			} else {
-				state.tiles[index].entity = ENTITY_TYPE_NONE;
-				state.tiles[new_index].entity = ENTITY_TYPE_PLAYER_A;
-				state.player_a_index = new_index;
-			}
+// a restart copies the start of the level back, finishing one swaps in the
+// next level the prefetch thread got ready while this one was played
+static void load_level(int index) {
+	if (index == (int)(sizeof(levels) / sizeof(levels[0]))) {
+		printf("Thanks for playing!\n");
+		glfwSetWindowShouldClose(window, GLFW_TRUE);
+		return;
+	}
+	if (!(level_start.ready && level_start.state.level_index == index) && !take_prefetched(index, &level_start))
+		prepare_level(&level_start, levels[index], index);
+	install_level(&level_start);
+	start_prefetch(index + 1);
+}
 
-		} break;
-		case ENTITY_TYPE_PLAYER_BOTH: {
-			if (state.tiles[new_index].entity == ENTITY_TYPE_COLLECTABLE) {
-				++state.collected;
-				if (state.collected == state.collectable_count) {
-					state.exit_open = true;
-				}
+// the scene is always drawn at WIDTH x HEIGHT, this only decides where it
+// lands on screen: the biggest whole multiple that fits, centred, with the
+// rest left as black bars
+static void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
+	int scale_x = width / WIDTH;
+	int scale_y = height / HEIGHT;
+	int scale = scale_x < scale_y ? scale_x : scale_y;
+	if (scale < 1)
+		scale = 1;
+
+	present_width = WIDTH * scale;
+	present_height = HEIGHT * scale;
+	present_x = (width - present_width) / 2;
+	present_y = (height - present_height) / 2;
+}
+
+static const Move_Action move_actions[MOVE_ACTIONS] = {
+	[MOVE_ACTION_NONE] = { MOVE_KEEP, MOVE_KEEP, MOVE_KEEP, MOVE_KEEP, MOVE_AT_START, MOVE_AT_START, 0, MOVE_RESULT_NONE },
+	[MOVE_ACTION_EXIT] = { MOVE_KEEP, MOVE_KEEP, MOVE_KEEP, MOVE_KEEP, MOVE_AT_START, MOVE_AT_START, 0, MOVE_RESULT_LEVEL_COMPLETE },
+	[MOVE_ACTION_STEP] = { ENTITY_TYPE_NONE, ENTITY_TYPE_PLAYER_A, MOVE_KEEP, MOVE_KEEP, MOVE_AT_TARGET, MOVE_AT_START, 0, MOVE_RESULT_NONE },
+	[MOVE_ACTION_STEP_COLLECT] = { ENTITY_TYPE_NONE, ENTITY_TYPE_PLAYER_A, MOVE_KEEP, MOVE_KEEP, MOVE_AT_TARGET, MOVE_AT_START, 1, MOVE_RESULT_NONE },
+	[MOVE_ACTION_RIDE] = { ENTITY_TYPE_NONE, ENTITY_TYPE_PLAYER_BOTH, MOVE_KEEP, MOVE_KEEP, MOVE_AT_TARGET, MOVE_AT_TARGET, 0, MOVE_RESULT_NONE },
+	[MOVE_ACTION_PUSH_B] = { ENTITY_TYPE_NONE, ENTITY_TYPE_PLAYER_A, ENTITY_TYPE_PLAYER_B, MOVE_KEEP, MOVE_AT_TARGET, MOVE_AT_BEYOND, 0, MOVE_RESULT_NONE },
+	[MOVE_ACTION_PUSH_BLOCK] = { ENTITY_TYPE_NONE, ENTITY_TYPE_PLAYER_A, ENTITY_TYPE_BLOCK, MOVE_KEEP, MOVE_AT_TARGET, MOVE_AT_START, 0, MOVE_RESULT_NONE },
+	[MOVE_ACTION_SINK_BLOCK] = { ENTITY_TYPE_NONE, ENTITY_TYPE_PLAYER_A, MOVE_KEEP, TILE_TYPE_NORMAL, MOVE_AT_TARGET, MOVE_AT_START, 0, MOVE_RESULT_NONE },
+	[MOVE_ACTION_LEAVE_B] = { ENTITY_TYPE_PLAYER_B, ENTITY_TYPE_PLAYER_A, MOVE_KEEP, MOVE_KEEP, MOVE_AT_TARGET, MOVE_AT_START, 0, MOVE_RESULT_NONE },
+	[MOVE_ACTION_LEAVE_B_COLLECT] = { ENTITY_TYPE_PLAYER_B, ENTITY_TYPE_PLAYER_A, MOVE_KEEP, MOVE_KEEP, MOVE_AT_TARGET, MOVE_AT_START, 1, MOVE_RESULT_NONE },
+	[MOVE_ACTION_LEAVE_B_PUSH_BLOCK] = { ENTITY_TYPE_PLAYER_B, ENTITY_TYPE_PLAYER_A, ENTITY_TYPE_BLOCK, MOVE_KEEP, MOVE_AT_TARGET, MOVE_AT_START, 0, MOVE_RESULT_NONE },
+	[MOVE_ACTION_LEAVE_B_SINK_BLOCK] = { ENTITY_TYPE_PLAYER_B, ENTITY_TYPE_PLAYER_A, MOVE_KEEP, TILE_TYPE_NORMAL, MOVE_AT_TARGET, MOVE_AT_START, 0, MOVE_RESULT_NONE },
+};
+
+// move_actions id by who moves, whether the exit is open, and the tile
+// codes of the target and beyond tiles. filled in from pick_move_action
+static u8 move_rules[ENTITY_TYPES][2][TILE_CODES][TILE_CODES];
+
+// the rules of the game, in one place. only called to fill move_rules, so
+// a new tile type only needs a case here. beyond is TILE_CODE_BLOCKED when
+// there's no tile past the target to push anything onto
+static Move_Action_Id pick_move_action(Entity_Type mover, bool exit_open, int target, int beyond) {
+	if (target == TILE_CODE_BLOCKED)
+		return MOVE_ACTION_NONE;
+	Tile_Type target_type = target / ENTITY_TYPES;
+	Entity_Type target_entity = target % ENTITY_TYPES;
+	Tile_Type beyond_type = beyond / ENTITY_TYPES;
+	Entity_Type beyond_entity = beyond % ENTITY_TYPES;
+	bool can_push = beyond != TILE_CODE_BLOCKED;
+
+	switch (mover) {
+	case ENTITY_TYPE_PLAYER_A: {
+		switch (target_entity) {
+		case ENTITY_TYPE_COLLECTABLE: return MOVE_ACTION_STEP_COLLECT;
+		case ENTITY_TYPE_PLAYER_B: {
+			if (target_type == TILE_TYPE_WATER)
+				return MOVE_ACTION_RIDE;
+			if (target_type == TILE_TYPE_GOAL && exit_open)
+				return MOVE_ACTION_EXIT;
+			if (!can_push || beyond_entity == ENTITY_TYPE_BLOCK)
+				return MOVE_ACTION_NONE;
+			return MOVE_ACTION_PUSH_B;
+		}
+		case ENTITY_TYPE_BLOCK: {
+			if (!can_push)
+				return MOVE_ACTION_NONE;
+			// a block pushed into water fills it and is gone
+			return beyond_type == TILE_TYPE_WATER ? MOVE_ACTION_SINK_BLOCK : MOVE_ACTION_PUSH_BLOCK;
+		}
+		default: return MOVE_ACTION_STEP;
+		}
+	}
+	// A steps off B, who stays on the water
+	case ENTITY_TYPE_PLAYER_BOTH: {
+		switch (target_entity) {
+		case ENTITY_TYPE_COLLECTABLE: return MOVE_ACTION_LEAVE_B_COLLECT;
+		case ENTITY_TYPE_BLOCK: {
+			// A gets on top of a block it can't push
+			if (!can_push)
+				return MOVE_ACTION_LEAVE_B;
+			return beyond_type == TILE_TYPE_WATER ? MOVE_ACTION_LEAVE_B_SINK_BLOCK : MOVE_ACTION_LEAVE_B_PUSH_BLOCK;
+		}
+		default: return MOVE_ACTION_LEAVE_B;
+		}
+	}
+	default: return MOVE_ACTION_NONE;
+	}
+}
+
+static void setup_move_rules() {
+	for (int mover = 0; mover < ENTITY_TYPES; ++mover) {
+		for (int exit_open = 0; exit_open < 2; ++exit_open) {
+			for (int target = 0; target < TILE_CODES; ++target) {
+				for (int beyond = 0; beyond < TILE_CODES; ++beyond)
+					move_rules[mover][exit_open][target][beyond] = pick_move_action(mover, exit_open, target, beyond);
 			}
-			// pushing a block
-			if (state.tiles[new_index].entity == ENTITY_TYPE_BLOCK) {
-				int new_block_index = can_move(direction, new_index);
-				if (new_block_index >= 0) {
-					if (state.tiles[new_block_index].type == TILE_TYPE_WATER)
-						state.tiles[new_block_index].type = TILE_TYPE_NORMAL;
-					else
-						state.tiles[new_block_index].entity = ENTITY_TYPE_BLOCK;
-					state.tiles[new_index].entity = ENTITY_TYPE_PLAYER_A;
-					state.tiles[index].entity = ENTITY_TYPE_NONE;
-					state.player_a_index = new_index;
+		}
+	}
+}
+
+static int tile_code(int index) {
+	return index >= 0 ? state.tiles[index].type * ENTITY_TYPES + state.tiles[index].entity : TILE_CODE_BLOCKED;
+}
+
+static u8 keep_or(u8 value, u8 current) {
+	return value == MOVE_KEEP ? current : value;
+}
+
+// blocks and collectables, the entities the slide table is built from
+static bool stays_put(Entity_Type entity) {
+	return entity == ENTITY_TYPE_BLOCK || entity == ENTITY_TYPE_COLLECTABLE;
+}
+
+static void update_slide_table() {
+	if (slides.valid)
+		return;
+
+	u64 entities = 0;
+	for (int i = 0; i < 64; ++i) {
+		if (stays_put(state.tiles[i].entity))
+			entities |= (u64)1 << i;
+	}
+	for (int index = 0; index < 64; ++index) {
+		for (int direction = LEFT; direction <= DOWN; ++direction) {
+			int end = index;
+			if (state.tiles[index].type == TILE_TYPE_ICE) {
+				// keep going over ice, the first other tile stops it
+				for (;;) {
+					int next = can_move(direction, end);
+					if (next < 0 || entities & (u64)1 << next)
+						break;
+					end = next;
+					if (state.tiles[end].type != TILE_TYPE_ICE)
+						break;
 				}
 			}
-			state.player_a_index = new_index;
-			state.tiles[new_index].entity = ENTITY_TYPE_PLAYER_A;
-			state.tiles[index].entity = ENTITY_TYPE_PLAYER_B;
-		} break;
-		default: break;
+			slides.ends[index][direction] = end;
+		}
+	}
+	slides.valid = true;
+}
+
+// where a slide from index stops, short of A or B if either is in the way
+static int slide_end(int index, int direction) {
+	update_slide_table();
+	int end = slides.ends[index][direction];
+	int step = direction_steps[direction];
+	int players[2] = { state.player_a_index, state.player_b_index };
+	for (int i = 0; i < 2; ++i) {
+		int p = players[i];
+		bool in_line = direction <= RIGHT ? p / 8 == index / 8 : p % 8 == index % 8;
+		if (!in_line || p == index)
+			continue;
+		// steps from index to p, and to the current end
+		int along = (p - index) / step;
+		if (along > 0 && along <= (end - index) / step)
+			end = p - step;
+	}
+	return end;
+}
+
+// events past MOVE_EVENTS are dropped, no move makes that many
+static void add_event(Move_Events *events, Move_Event_Type type, int value, int from, int to) {
+	if (events->count == MOVE_EVENTS)
+		return;
+	events->events[events->count++] = (Move_Event){ type, value, from, to };
+}
+
+// a slide carries on from where the step before it stopped, so that's
+// one longer move rather than two
+static void add_moved(Move_Events *events, Entity_Type entity, int from, int to) {
+	if (from == to)
+		return;
+	for (u32 i = 0; i < events->count; ++i) {
+		Move_Event *event = &events->events[i];
+		if (event->type == MOVE_EVENT_MOVED && event->value == entity && event->to == from) {
+			event->to = to;
+			return;
 		}
 	}
+	add_event(events, MOVE_EVENT_MOVED, entity, from, to);
+}
+
+// where link of the chain is drawn, -1 when it's hidden
+static int chain_link(const State *s, int link) {
+	return s->chain_visible[link] ? s->chain_indices[link] : -1;
+}
+
+// moves whatever is on index to end, where try_move worked out its slide
+// stops. A sliding onto water drowns the same as stepping there
+static void slide(int index, int end, Move_Events *events) {
+	if (end == index)
+		return;
+
+	Tile *from = &state.tiles[index];
+	Tile *to = &state.tiles[end];
+	add_moved(events, from->entity, index, end);
+	if (from->entity == ENTITY_TYPE_BLOCK)
+		slides.valid = false;
+	if (from->entity == ENTITY_TYPE_BLOCK && to->type == TILE_TYPE_WATER) {
+		// a block sliding into water fills it, same as pushing it in
+		to->type = TILE_TYPE_NORMAL;
+		add_event(events, MOVE_EVENT_TILE, TILE_TYPE_NORMAL, end, end);
+	} else {
+		to->entity = from->entity;
+	}
+	from->entity = ENTITY_TYPE_NONE;
+}
+
+// only touches state, what to do about the result is up to the caller.
+// one lookup in move_rules picks the action, which is then applied the
+// same way whatever it is. a missing target or beyond tile stands in as
+// the start tile, which the action then leaves alone. events gets what
+// changed, see Move_Events
+static Move_Result try_move(int direction, int index, Move_Events *events) {
+	events->count = 0;
+	int target = can_move(direction, index);
+	int beyond = target >= 0 ? can_move(direction, target) : -1;
+	const Move_Action *action = &move_actions[move_rules[state.tiles[index].entity][state.exit_open][tile_code(target)][tile_code(beyond)]];
+	if (action->result == MOVE_RESULT_LEVEL_COMPLETE)
+		add_event(events, MOVE_EVENT_LEVEL_COMPLETE, 0, -1, -1);
+	if (action->result != MOVE_RESULT_NONE)
+		return action->result;
+
+	int at[3] = { index, target >= 0 ? target : index, beyond >= 0 ? beyond : index };
+	int a = state.player_a_index;
+	int b = state.player_b_index;
+
+	// where everything ends up is worked out before state is touched, so a
+	// move snow won't allow just doesn't happen. whatever got pushed slides
+	// first, and A slides up right behind it, or onto the water it filled
+	bool pushed = action->beyond_entity != MOVE_KEEP || action->beyond_type != MOVE_KEEP;
+	bool pushed_block = action->beyond_entity == ENTITY_TYPE_BLOCK || action->beyond_type != MOVE_KEEP;
+	int pushed_end = at[MOVE_AT_BEYOND];
+	if (action->beyond_entity != MOVE_KEEP && state.tiles[pushed_end].type == TILE_TYPE_ICE)
+		pushed_end = slide_end(pushed_end, direction);
+	bool sunk = action->beyond_type != MOVE_KEEP ||
+		(action->beyond_entity == ENTITY_TYPE_BLOCK && state.tiles[pushed_end].type == TILE_TYPE_WATER);
+	int a_end = action->a_to == MOVE_AT_START ? a : at[action->a_to];
+	int b_end = action->b_to == MOVE_AT_START ? b : action->b_to == MOVE_AT_BEYOND ? pushed_end : at[action->b_to];
+	if (action->a_to == MOVE_AT_TARGET && action->b_to != MOVE_AT_TARGET && state.tiles[a_end].type == TILE_TYPE_ICE) {
+		if (pushed)
+			a_end = sunk ? pushed_end : pushed_end - direction_steps[direction];
+		else
+			a_end = slide_end(a_end, direction);
+	}
+
+	// pull chain. after a slide B can be more than one step too far away,
+	// so it's walked along the path until it's two tiles from A again.
+	// snow holds on to B, so a pull that would take B off or across a snow
+	// tile stops the whole move
+	// a pushed block leaves target, and whatever it was pushed onto goes too
+	u64 cleared = pushed_block ? (u64)1 << at[MOVE_AT_TARGET] | (u64)1 << at[MOVE_AT_BEYOND] : 0;
+	int block_to = pushed_block && !sunk ? pushed_end : -1;
+	BFS_Result r = bfs_moved(&state, a_end, b_end, direction, cleared, block_to);
+	int pulled = b_end;
+	for (int steps = 2; steps < r.distance; ++steps) {
+		if (level_analysis.snow >> pulled & 1)
+			return MOVE_RESULT_NONE;
+		pulled = r.came_from[pulled];
+	}
+
+	int links[2] = { chain_link(&state, 0), chain_link(&state, 1) };
+	bool exit_open = state.exit_open;
+	Tile *from = &state.tiles[at[MOVE_AT_START]];
+	Tile *to = &state.tiles[at[MOVE_AT_TARGET]];
+	Tile *past = &state.tiles[at[MOVE_AT_BEYOND]];
+	// the slide table goes stale whenever a block or collectable is written
+	// over, by a push, a collect or A climbing onto a block
+	if ((action->target_entity != MOVE_KEEP && stays_put(to->entity)) || (action->beyond_entity != MOVE_KEEP && stays_put(past->entity)))
+		slides.valid = false;
+	past->type = keep_or(action->beyond_type, past->type);
+	past->entity = keep_or(action->beyond_entity, past->entity);
+	to->entity = keep_or(action->target_entity, to->entity);
+	from->entity = keep_or(action->from_entity, from->entity);
+	at[MOVE_AT_START] = state.player_a_index;
+	state.player_a_index = at[action->a_to];
+	at[MOVE_AT_START] = state.player_b_index;
+	state.player_b_index = at[action->b_to];
+	state.collected += action->collect;
+	state.exit_open |= action->collect && state.collected == state.collectable_count;
+
+	add_moved(events, ENTITY_TYPE_PLAYER_A, a, state.player_a_index);
+	add_moved(events, ENTITY_TYPE_PLAYER_B, b, state.player_b_index);
+	if (pushed_block)
+		add_moved(events, ENTITY_TYPE_BLOCK, at[MOVE_AT_TARGET], at[MOVE_AT_BEYOND]);
+	if (action->beyond_type != MOVE_KEEP)
+		add_event(events, MOVE_EVENT_TILE, action->beyond_type, at[MOVE_AT_BEYOND], at[MOVE_AT_BEYOND]);
+	if (action->collect)
+		add_event(events, MOVE_EVENT_COLLECTED, ENTITY_TYPE_COLLECTABLE, at[MOVE_AT_TARGET], at[MOVE_AT_TARGET]);
+	if (state.exit_open != exit_open)
+		add_event(events, MOVE_EVENT_EXIT_OPENED, 0, -1, -1);
+
+	if (action->beyond_entity != MOVE_KEEP)
+		slide(at[MOVE_AT_BEYOND], pushed_end, events);
+	slide(state.player_a_index, a_end, events);
+	state.player_a_index = a_end;
+	state.player_b_index = b_end;
 
-	// pull chain
-	BFS_Result r = bfs(state.player_a_index, state.player_b_index, direction);
 	if (r.distance > 2) {
-		state.chain_indices[0] = r.path[3];
-		state.chain_indices[1] = r.path[2];
+		state.chain_indices[1] = r.came_from[pulled];
+		state.chain_indices[0] = r.came_from[state.chain_indices[1]];
+		// the chain's path can run over a collectable, which B then covers
+		if (stays_put(state.tiles[pulled].entity))
+			slides.valid = false;
 		state.tiles[state.player_b_index].entity = ENTITY_TYPE_NONE;
-		state.tiles[r.path[1]].entity = ENTITY_TYPE_PLAYER_B;
-		state.player_b_index = r.path[1];
+		state.tiles[pulled].entity = ENTITY_TYPE_PLAYER_B;
+		add_moved(events, ENTITY_TYPE_PLAYER_B, state.player_b_index, pulled);
+		state.player_b_index = pulled;
 		state.chain_visible[0] = 1;
 		state.chain_visible[1] = 1;
 	} else {
@@ -448,55 +1428,301 @@ static void try_move(int direction, int index) {
 			state.chain_visible[1] = 1;
 		}
 	}
+	for (int link = 0; link < 2; ++link) {
+		if (chain_link(&state, link) != links[link])
+			add_event(events, MOVE_EVENT_CHAIN, link, links[link], chain_link(&state, link));
+	}
 
 	// game over
 	if (state.tiles[state.player_a_index].type == TILE_TYPE_WATER && state.player_a_index != state.player_b_index) {
-		load_level(state.level_index);
+		add_event(events, MOVE_EVENT_DIED, 0, -1, -1);
+		return MOVE_RESULT_DIED;
 	}
+
+	return MOVE_RESULT_NONE;
 }
 
-static void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
-	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
-		glfwSetWindowShouldClose(window, GLFW_TRUE);
+// a reload replaces the whole state, so the move's own events are dropped
+// and only the one that caused it is left
+static void reloaded(Move_Events *events, Move_Event_Type type) {
+	events->count = 0;
+	add_event(events, type, 0, -1, -1);
+}
 
-	if (key == GLFW_KEY_LEFT && action == GLFW_PRESS) {
-		try_move(LEFT, state.player_a_index);
-	} else if (key == GLFW_KEY_RIGHT && action == GLFW_PRESS) {
-		try_move(RIGHT, state.player_a_index);
-	} else if (key == GLFW_KEY_UP && action == GLFW_PRESS) {
-		try_move(UP, state.player_a_index);
-	} else if (key == GLFW_KEY_DOWN && action == GLFW_PRESS) {
-		try_move(DOWN, state.player_a_index);
+// returns true if a level got (re)loaded
+static bool player_move(int direction, Move_Events *events) {
+	atomic_fetch_add_explicit(&moves_made, 1, memory_order_relaxed);
+	switch (try_move(direction, state.player_a_index, events)) {
+	case MOVE_RESULT_LEVEL_COMPLETE: {
+		reloaded(events, MOVE_EVENT_LEVEL_COMPLETE);
+		load_level(state.level_index + 1);
+		return true;
+	}
+	case MOVE_RESULT_DIED: {
+		reloaded(events, MOVE_EVENT_DIED);
+		load_level(state.level_index);
+		return true;
+	}
+	case MOVE_RESULT_NONE: {
+		if (is_dead_state()) {
+			printf("Level can't be finished any more, restarting\n");
+			reloaded(events, MOVE_EVENT_RESTARTED);
+			load_level(state.level_index);
+			return true;
+		}
+	} break;
 	}
+	return false;
 }
 
-static void setup_window() {
-	glfwSetErrorCallback(error_and_exit);
-	if (!glfwInit()) {
-		error_and_exit(-1, "Failed to init GLFW");
+static bool input_push(Input_Queue *queue, Input_Event event) {
+	u32 tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	u32 head = atomic_load_explicit(&queue->head, memory_order_acquire);
+	if (tail - head == INPUT_QUEUE_SIZE) {
+		++queue->dropped;
+		return false;
 	}
+	queue->events[tail & (INPUT_QUEUE_SIZE - 1)] = event;
+	atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+	return true;
+}
 
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+static bool input_pop(Input_Queue *queue, Input_Event *event) {
+	u32 head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	u32 tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+	if (head == tail)
+		return false;
+	*event = queue->events[head & (INPUT_QUEUE_SIZE - 1)];
+	atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+	return true;
+}
 
-	window = glfwCreateWindow(WIDTH * SCALE, HEIGHT * SCALE, "Puzzle game", glfwGetPrimaryMonitor(), NULL);
-	if (!window) {
-		error_and_exit(-1, "Failed to create window");
-	}
+// true while update() still has a move to play. the consumer only pops a
+// move once it's due, so this stays true for the whole wait
+static bool input_pending(Input_Queue *queue) {
+	u32 head = atomic_load_explicit(&queue->head, memory_order_acquire);
+	u32 tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	return head != tail;
+}
 
-	glfwSetKeyCallback(window, key_callback);
+// only queues the move, update() plays it. presses are always queued, but
+// a held arrow only repeats when nothing is waiting: the OS repeats faster
+// than moves play, and queueing every repeat would keep walking long after
+// the key comes up
+static void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
+	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
+		glfwSetWindowShouldClose(window, GLFW_TRUE);
+	if (key == GLFW_KEY_F3 && action == GLFW_PRESS) {
+		frame_stats.hud = !frame_stats.hud;
+	}
 
-	glfwMakeContextCurrent(window);
+	if (action != GLFW_PRESS && action != GLFW_REPEAT)
+		return;
 
-	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
-		error_and_exit(-1, "Failed to init GLAD");
+	Input_Event event = { .time = glfwGetTime() };
+	switch (key) {
+	case GLFW_KEY_LEFT: event.direction = LEFT; break;
+	case GLFW_KEY_RIGHT: event.direction = RIGHT; break;
+	case GLFW_KEY_UP: event.direction = UP; break;
+	case GLFW_KEY_DOWN: event.direction = DOWN; break;
+	default: return;
 	}
+	if (action == GLFW_REPEAT && input_pending(&input_queue))
+		return;
+	if (!input_push(&input_queue, event)) {
+		if (input_queue.dropped == 1)
+			fprintf(stderr, "Input queue full, key presses are being dropped\n");
+		return;
+	}
+	sem_post(&input_ready);
+}
 
-	glViewport(0, 0, WIDTH * SCALE, HEIGHT * SCALE);
-	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+static void publish_state(const Move_Events *events) {
+	Snapshot *snapshot = &state_buffer.slots[state_buffer.back];
+	memcpy(&snapshot->current, &state, sizeof(State));
+	memcpy(&snapshot->events, events, sizeof(Move_Events));
+	snapshot->move_time = move_time;
+	snapshot->revision = ++state_revision;
+	state_buffer.back = atomic_exchange(&state_buffer.middle, state_buffer.back | STATE_BUFFER_FRESH) & 3;
 }
 
-static void setup_rendering() {
+// the one place moves happen, one queued move at a time, so presses made
+// during a level load or an animation aren't lost. a fresh level isn't
+// animated into, its events have nothing that moved
+static void update() {
+	Input_Event event;
+	if (!input_pop(&input_queue, &event))
+		return;
+	event.move_start = glfwGetTime();
+	u64 allocated = thread_allocations;
+	Move_Events events;
+	player_move(event.direction, &events);
+	move_time = glfwGetTime();
+	// the trace goes first, render could pick the snapshot up before it
+	// arrived and put the move on a later frame
+	if (latency_stats.enabled) {
+		event.move_end = move_time;
+		event.revision = state_revision + 1;
+		input_push(&trace_queue, event);
+	}
+	publish_state(&events);
+	count_move_allocations(thread_allocations - allocated);
+}
+
+static void sleep_seconds(f64 seconds) {
+	struct timespec duration = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+	nanosleep(&duration, NULL);
+}
+
+// latest published snapshot, stays valid until the next call
+static const Snapshot *acquire_state() {
+	if (atomic_load(&state_buffer.middle) & STATE_BUFFER_FRESH)
+		state_buffer.front = atomic_exchange(&state_buffer.middle, state_buffer.front) & 3;
+	return &state_buffer.slots[state_buffer.front];
+}
+
+// owns state once the game is running. sleeps until key_callback queues
+// something, so slow swaps on the render thread never hold up a move. the
+// semaphore is posted once per queued move
+static void *simulation_main(void *arg) {
+	for (;;) {
+		sem_wait(&input_ready);
+		if (atomic_load(&simulation_quit))
+			break;
+		f64 remaining = move_time + MOVE_DURATION - glfwGetTime();
+		if (remaining > 0)
+			sleep_seconds(remaining);
+		update();
+	}
+	return NULL;
+}
+
+static void start_simulation() {
+	state_buffer.front = 0;
+	state_buffer.back = 2;
+	atomic_init(&state_buffer.middle, 1);
+	Move_Events events = {0};
+	publish_state(&events);
+
+	if (sem_init(&input_ready, 0, 0) != 0)
+		error_and_exit(-1, "Failed to create input semaphore");
+	if (pthread_create(&simulation_thread, NULL, simulation_main, NULL) != 0)
+		error_and_exit(-1, "Failed to start simulation thread");
+}
+
+static void stop_simulation() {
+	atomic_store(&simulation_quit, true);
+	sem_post(&input_ready);
+	pthread_join(simulation_thread, NULL);
+	sem_destroy(&input_ready);
+	finish_prefetch();
+}
+
+// glad resolves every function it knows about, the trimmed loader only
+// the ones main.c calls
+static void load_gl(GLADloadproc load) {
+	f64 start = now_ms();
+#ifdef TRIMMED_GL
+	int loaded = gl_load(load);
+#else
+	int loaded = gladLoadGLLoader(load);
+#endif
+	if (!loaded)
+		error_and_exit(-1, "Failed to load GL");
+	gl_load_time = now_ms() - start;
+}
+
+static void use_program(u32 program) {
+	if (render_cache.program == program)
+		return;
+	render_cache.program = program;
+	++render_cache.calls;
+	glUseProgram(program);
+}
+
+static void bind_vertex_array(u32 vertex_array) {
+	if (render_cache.vertex_array == vertex_array)
+		return;
+	render_cache.vertex_array = vertex_array;
+	++render_cache.calls;
+	glBindVertexArray(vertex_array);
+}
+
+// only ever texture unit 0
+static void bind_texture(u32 texture) {
+	if (render_cache.texture == texture)
+		return;
+	render_cache.texture = texture;
+	++render_cache.calls;
+	glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+static void bind_framebuffer(u32 target, u32 framebuffer) {
+	bool read = target != GL_DRAW_FRAMEBUFFER && render_cache.read_framebuffer != framebuffer;
+	bool draw = target != GL_READ_FRAMEBUFFER && render_cache.draw_framebuffer != framebuffer;
+	if (read && draw) {
+		target = GL_FRAMEBUFFER;
+	} else if (read) {
+		target = GL_READ_FRAMEBUFFER;
+	} else if (draw) {
+		target = GL_DRAW_FRAMEBUFFER;
+	} else {
+		return;
+	}
+	if (read)
+		render_cache.read_framebuffer = framebuffer;
+	if (draw)
+		render_cache.draw_framebuffer = framebuffer;
+	++render_cache.calls;
+	glBindFramebuffer(target, framebuffer);
+}
+
+static void setup_window() {
+	glfwSetErrorCallback(error_and_exit);
+	if (!glfwInit()) {
+		error_and_exit(-1, "Failed to init GLFW");
+	}
+
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+
+	window = glfwCreateWindow(WIDTH * SCALE, HEIGHT * SCALE, "Puzzle game", glfwGetPrimaryMonitor(), NULL);
+	if (!window) {
+		error_and_exit(-1, "Failed to create window");
+	}
+
+	glfwSetKeyCallback(window, key_callback);
+
+	glfwMakeContextCurrent(window);
+
+	load_gl((GLADloadproc)glfwGetProcAddress);
+
+	// nothing is ever drawn straight to the window, see render
+	glViewport(0, 0, WIDTH, HEIGHT);
+
+	// the callback only fires on changes, and the monitor may not have
+	// given us the size we asked for
+	int width, height;
+	glfwGetFramebufferSize(window, &width, &height);
+	framebuffer_size_callback(window, width, height);
+	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+}
+
+static void create_render_target(u32 *fbo, u32 *texture, int width, int height) {
+	glGenTextures(1, texture);
+	bind_texture(*texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glGenFramebuffers(1, fbo);
+	bind_framebuffer(GL_FRAMEBUFFER, *fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *texture, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		error_and_exit(-1, "Render target framebuffer is incomplete");
+	bind_framebuffer(GL_FRAMEBUFFER, 0);
+}
+
+static void setup_rendering() {
 	f32 square_vertices[] = {
 		 0.5f,  0.5f, 0.0f,
 		 0.5f, -0.5f, 0.0f,
@@ -511,7 +1737,7 @@ static void setup_rendering() {
 	glGenBuffers(1, &square_vbo);
 	glGenBuffers(1, &square_ebo);
 
-	glBindVertexArray(square_vao);
+	bind_vertex_array(square_vao);
 	glBindBuffer(GL_ARRAY_BUFFER, square_vao);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(square_vertices), square_vertices, GL_STATIC_DRAW);
 
@@ -522,71 +1748,385 @@ static void setup_rendering() {
 	glEnableVertexAttribArray(0);
 
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+	bind_vertex_array(0);
 
-	f32 line_vertices[] = { 0, 0, 0, 1, 1, 1 };
-	glGenVertexArrays(1, &line_vao);
-	glGenBuffers(1, &line_vbo);
+	// squares and the chain drawn each frame, see render_square
+	glGenBuffers(1, &stream.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, stream.vbo);
+	glBufferData(GL_ARRAY_BUFFER, STREAM_FRAMES * STREAM_REGION_SIZE, NULL, GL_STREAM_DRAW);
 
-	glBindVertexArray(line_vao);
-	glBindBuffer(GL_ARRAY_BUFFER, line_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(line_vertices), line_vertices, GL_DYNAMIC_DRAW);
+	glGenVertexArrays(1, &batch_vao);
+	bind_vertex_array(batch_vao);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Batch_Vertex), (void *)offsetof(Batch_Vertex, x));
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Batch_Vertex), (void *)offsetof(Batch_Vertex, color));
+	glEnableVertexAttribArray(1);
 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(f32), NULL);
+	// the chain, as a strip of points. see render_chain
+	glGenVertexArrays(1, &line_vao);
+	bind_vertex_array(line_vao);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(f32), NULL);
 	glEnableVertexAttribArray(0);
 
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+	bind_vertex_array(0);
+
+	// one texel of tile type and entity per tile, see render_board
+	glGenTextures(1, &board_texture);
+	bind_texture(board_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8UI, 8, 8, 0, GL_RG_INTEGER, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	// both at game resolution: the static layer, see render_static_layer,
+	// and the whole frame, which is scaled up to the window in render
+	create_render_target(&static_fbo, &static_texture, WIDTH, HEIGHT);
+	create_render_target(&scene_fbo, &scene_texture, WIDTH, HEIGHT);
 
 	mat4x4_ortho(projection, 0, WIDTH, 0, HEIGHT, -2.0f, 2.0f);
+
+	// nothing in here changes after startup, so both programs share one
+	// buffer instead of each setting its own uniforms
+	Globals_Block globals;
+	memcpy(globals.projection, projection, sizeof(mat4x4));
+	memcpy(globals.outline_color, color_tile_outline, sizeof(vec4));
+	memcpy(globals.fill_color, color_tile_fill, sizeof(vec4));
+	memcpy(globals.wall_color, color_white, sizeof(vec4));
+	memcpy(globals.water_color, color_water, sizeof(vec4));
+	memcpy(globals.goal_color, color_goal, sizeof(vec4));
+	memcpy(globals.collectable_color, color_green, sizeof(vec4));
+	memcpy(globals.ice_color, color_ice, sizeof(vec4));
+	memcpy(globals.snow_color, color_snow, sizeof(vec4));
+	glGenBuffers(1, &globals_ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, globals_ubo);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(Globals_Block), &globals, GL_STATIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, GLOBALS_BINDING, globals_ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	// a driver without a timer just leaves the gpu times out of the stats
+	int timer_bits = 0;
+	glGetQueryiv(GL_TIME_ELAPSED, GL_QUERY_COUNTER_BITS, &timer_bits);
+	frame_stats.timer_queries = timer_bits > 0;
+	if (frame_stats.timer_queries)
+		glGenQueries(FRAME_QUERIES, frame_stats.queries);
 }
 
-static void setup_shaders() {
+static u32 compile_shader(u32 type, const char *source) {
 	int success;
 	char log[512];
-	char *vertex_source = read_file_into_buffer("shader.vert");
-	uint32_t vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertex_shader, 1, (const char *const *)&vertex_source, NULL);
-	glCompileShader(vertex_shader);
-	glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &success);
+	u32 shader = glCreateShader(type);
+	const char *sources[2] = { shader_header, source };
+	glShaderSource(shader, 2, sources, NULL);
+	glCompileShader(shader);
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
 	if (!success) {
-		glGetShaderInfoLog(vertex_shader, 512, NULL, log);
+		glGetShaderInfoLog(shader, 512, NULL, log);
 		error_and_exit(-1, log);
 	}
+	return shader;
+}
 
-	char *fragment_source = read_file_into_buffer("shader.frag");
-	uint32_t fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragment_shader, 1, (const char *const *)&fragment_source, NULL);
-	glCompileShader(fragment_shader);
-	glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &success);
-	if (!success) {
-		glGetShaderInfoLog(fragment_shader, 512, NULL, log);
-		error_and_exit(-1, log);
+// fnv-1a
+static u64 hash_bytes(u64 hash, const void *data, size_t size) {
+	const u8 *bytes = data;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
 	}
+	return hash;
+}
+
+static bool program_binary_supported() {
+	if (!glGetProgramBinary || !glProgramBinary)
+		return false;
+	int formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+// linked programs are cached in the working directory, named by a hash
+// of the sources so the file can be found before there is a context. the
+// driver that wrote it is stored inside and has to match
+static void program_cache_path(char *path, size_t size, const char *const paths[3]) {
+	u64 hash = hash_bytes(0xcbf29ce484222325ull, shader_header, sizeof(shader_header));
+	for (int i = 0; i < 3; ++i) {
+		if (!paths[i])
+			continue;
+		const char *source = load_asset(paths[i]);
+		hash = hash_bytes(hash, source, strlen(source) + 1);
+		release_asset(source);
+	}
+	snprintf(path, size, "program-%016llx.bin", (unsigned long long)hash);
+}
+
+static u8 *read_cache_file(const char *path, long *size) {
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return NULL;
+	fseek(fp, 0, SEEK_END);
+	*size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	u8 *data = *size > 0 ? malloc(*size) : NULL;
+	if (data && fread(data, *size, 1, fp) != 1) {
+		free(data);
+		data = NULL;
+	}
+	fclose(fp);
+	return data;
+}
+
+static void driver_string(char *driver, size_t size) {
+	snprintf(driver, size, "%s\n%s\n%s",
+		(const char *)glGetString(GL_VENDOR),
+		(const char *)glGetString(GL_RENDERER),
+		(const char *)glGetString(GL_VERSION));
+}
 
-	shader = glCreateProgram();
-	glAttachShader(shader, vertex_shader);
-	glAttachShader(shader, fragment_shader);
-	glLinkProgram(shader);
-	glGetProgramiv(shader, GL_LINK_STATUS, &success);
+// 0 if there is no usable cached binary. the file is
+// u32 driver length, driver, u32 binary format, binary
+static u32 load_cached_program(const char *path) {
+	u8 *data = NULL;
+	long size = 0;
+	for (int i = 0; i < PROGRAM_COUNT; ++i) {
+		if (preload.cache_files[i] && strcmp(preload.cache_paths[i], path) == 0) {
+			data = preload.cache_files[i];
+			size = preload.cache_sizes[i];
+			preload.cache_files[i] = NULL;
+		}
+	}
+	if (!data)
+		data = read_cache_file(path, &size);
+	if (!data)
+		return 0;
+
+	char driver[512];
+	driver_string(driver, sizeof(driver));
+	u32 driver_length;
+	u32 format;
+	u32 program = 0;
+	memcpy(&driver_length, data, size >= 4 ? 4 : 0);
+	long header = 4 + (long)driver_length + 4;
+	if (size > header && driver_length == strlen(driver) && memcmp(data + 4, driver, driver_length) == 0) {
+		int success;
+		memcpy(&format, data + 4 + driver_length, 4);
+		program = glCreateProgram();
+		glProgramBinary(program, format, data + header, size - header);
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		if (!success) {
+			glDeleteProgram(program);
+			program = 0;
+		}
+	}
+	free(data);
+	return program;
+}
+
+// best effort, a read only directory just means no cache
+static void save_cached_program(const char *path, u32 program) {
+	int length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	void *binary = malloc(length);
+	if (!binary)
+		return;
+	u32 format;
+	glGetProgramBinary(program, length, NULL, &format, binary);
+	char driver[512];
+	driver_string(driver, sizeof(driver));
+	u32 driver_length = strlen(driver);
+	FILE *fp = fopen(path, "wb");
+	if (fp) {
+		fwrite(&driver_length, sizeof(driver_length), 1, fp);
+		fwrite(driver, driver_length, 1, fp);
+		fwrite(&format, sizeof(format), 1, fp);
+		fwrite(binary, length, 1, fp);
+		fclose(fp);
+	}
+	free(binary);
+}
+
+// one row of program_paths
+static u32 load_program(const char *const paths[3]) {
+	bool cache = program_binary_supported();
+	char cache_path[64];
+	if (cache) {
+		program_cache_path(cache_path, sizeof(cache_path), paths);
+		u32 program = load_cached_program(cache_path);
+		if (program)
+			return program;
+	}
+
+	int success;
+	char log[512];
+	const GLenum stages[3] = { GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER };
+	u32 program = glCreateProgram();
+	for (int i = 0; i < 3; ++i) {
+		if (!paths[i])
+			continue;
+		const char *source = load_asset(paths[i]);
+		glAttachShader(program, compile_shader(stages[i], source));
+		release_asset(source);
+	}
+	if (cache)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(program);
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
 	if (!success) {
-		glGetProgramInfoLog(shader, 512, NULL, log);
+		glGetProgramInfoLog(program, 512, NULL, log);
 		error_and_exit(-1, log);
 	}
+
+	if (cache)
+		save_cached_program(cache_path, program);
+	return program;
 }
 
-static void render_square(f32 x, f32 y, f32 width, f32 height, vec4 color) {
+// everything startup needs that doesn't need gl: the first level, and the
+// cached program binaries off the disk. runs while glfw is busy creating
+// the window, which can take a while with a fullscreen mode switch
+static void *preload_main(void *data) {
+	load_level(0);
+	for (int i = 0; i < PROGRAM_COUNT; ++i) {
+		program_cache_path(preload.cache_paths[i], sizeof(preload.cache_paths[i]), program_paths[i]);
+		preload.cache_files[i] = read_cache_file(preload.cache_paths[i], &preload.cache_sizes[i]);
+	}
+	return NULL;
+}
+
+static void start_preload() {
+	if (pthread_create(&preload.thread, NULL, preload_main, NULL) != 0)
+		error_and_exit(-1, "Failed to start preload thread");
+	preload.running = true;
+}
+
+static void finish_preload() {
+	if (!preload.running)
+		return;
+	pthread_join(preload.thread, NULL);
+	preload.running = false;
+}
+
+static void setup_shaders() {
+	shader = load_program(program_paths[0]);
+	board_shader = load_program(program_paths[1]);
+	line_shader = load_program(program_paths[2]);
+	// only there if the driver turned out to have no binary formats
+	for (int i = 0; i < PROGRAM_COUNT; ++i) {
+		free(preload.cache_files[i]);
+		preload.cache_files[i] = NULL;
+	}
+
+	// the board never moves, so everything but the tiles is set once
 	mat4x4 model;
-	mat4x4_identity(model);
+	mat4x4_translate(model, BOARD_OFFSET_X + 4 * BOARD_TILE_SIZE, BOARD_OFFSET_Y + 4 * BOARD_TILE_SIZE, 0.0f);
+	mat4x4_scale_aniso(model, model, 8 * BOARD_TILE_SIZE, 8 * BOARD_TILE_SIZE, 1.0f);
 
-	mat4x4_translate(model, x + width * 0.5f, y + height * 0.5f, 0.0f);
-	mat4x4_scale_aniso(model, model, width, height, 1.0f);
+	use_program(board_shader);
+	glUniformMatrix4fv(glGetUniformLocation(board_shader, "model"), 1, GL_FALSE, &model[0][0]);
+	glUniform1i(glGetUniformLocation(board_shader, "board"), 0);
+	exit_open_location = glGetUniformLocation(board_shader, "exit_open");
 
-	glUniformMatrix4fv(glGetUniformLocation(shader, "model"), 1, GL_FALSE, &model[0][0]);
-	glUniform4fv(glGetUniformLocation(shader, "color"), 1, color);
+	use_program(line_shader);
+	glUniform1f(glGetUniformLocation(line_shader, "thickness"), BOARD_TILE_SIZE / 4);
+	glUniform4fv(glGetUniformLocation(line_shader, "color"), 1, color_white);
 
-	glBindVertexArray(square_vao);
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	glUniformBlockBinding(shader, glGetUniformBlockIndex(shader, "Globals"), GLOBALS_BINDING);
+	glUniformBlockBinding(board_shader, glGetUniformBlockIndex(board_shader, "Globals"), GLOBALS_BINDING);
+	glUniformBlockBinding(line_shader, glGetUniformBlockIndex(line_shader, "Globals"), GLOBALS_BINDING);
+
+	// only count what frames do
+	render_cache.calls = 0;
+}
+
+// move on to the next region, normally long since finished with
+static void stream_begin_frame() {
+	stream.region = (stream.region + 1) % STREAM_FRAMES;
+	stream.offset = 0;
+
+	GLsync fence = stream.fences[stream.region];
+	if (!fence)
+		return;
+	if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+		++stream.stalls;
+		glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		++render_cache.calls;
+	}
+	glDeleteSync(fence);
+	stream.fences[stream.region] = NULL;
+	render_cache.calls += 2;
+}
+
+static void stream_end_frame() {
+	stream.fences[stream.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	++render_cache.calls;
+}
+
+// copies size bytes into this frame's region and returns where they went,
+// lined up to stride so the caller can draw from them by vertex index
+static u32 stream_upload(const void *data, u32 size, u32 stride) {
+	u32 base = stream.region * STREAM_REGION_SIZE;
+	u32 start = (base + stream.offset + stride - 1) / stride * stride;
+	glBindBuffer(GL_ARRAY_BUFFER, stream.vbo);
+	if (start + size > base + STREAM_REGION_SIZE) {
+		// more than a frame's worth. fresh storage instead of waiting, the
+		// old one stays alive until the gpu is done with it
+		if (size > STREAM_REGION_SIZE)
+			error_and_exit(-1, "Stream upload is bigger than a frame");
+		glBufferData(GL_ARRAY_BUFFER, STREAM_FRAMES * STREAM_REGION_SIZE, NULL, GL_STREAM_DRAW);
+		for (int i = 0; i < STREAM_FRAMES; ++i) {
+			if (stream.fences[i])
+				glDeleteSync(stream.fences[i]);
+			stream.fences[i] = NULL;
+		}
+		++stream.orphans;
+		start = (base + stride - 1) / stride * stride;
+	}
+
+	void *memory = glMapBufferRange(GL_ARRAY_BUFFER, start, size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (!memory)
+		error_and_exit(-1, "Failed to map stream buffer");
+	memcpy(memory, data, size);
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+	render_cache.calls += 3;
+
+	stream.offset = start + size - base;
+	return start;
+}
+
+// every square queued since the last flush, in one draw
+static void flush_batch() {
+	if (batch_count == 0)
+		return;
+	u32 start = stream_upload(batch, batch_count * sizeof(Batch_Vertex), sizeof(Batch_Vertex));
+	use_program(shader);
+	bind_vertex_array(batch_vao);
+	glDrawArrays(GL_TRIANGLES, start / sizeof(Batch_Vertex), batch_count);
+	++render_cache.calls;
+	++render_cache.draws;
+	batch_count = 0;
+}
+
+// queued, drawn in order with everything else on the next flush_batch
+static void render_square(f32 x, f32 y, f32 width, f32 height, vec4 color) {
+	if (batch_count + 6 > BATCH_VERTICES)
+		flush_batch();
+
+	u8 c[4];
+	for (int i = 0; i < 4; ++i)
+		c[i] = (u8)(color[i] * 255.0f + 0.5f);
+	f32 corners[6][2] = {
+		{ x, y }, { x + width, y }, { x + width, y + height },
+		{ x, y }, { x + width, y + height }, { x, y + height },
+	};
+	for (int i = 0; i < 6; ++i) {
+		Batch_Vertex *vertex = &batch[batch_count++];
+		vertex->x = corners[i][0];
+		vertex->y = corners[i][1];
+		memcpy(vertex->color, c, 4);
+	}
 }
 
 static void render_entity(f32 x, f32 y, Entity_Type type) {
@@ -607,77 +2147,135 @@ static void render_entity(f32 x, f32 y, Entity_Type type) {
 	}
 }
 
-static void render_chain() {
+static f32 ease_out(f32 t) {
+	f32 u = 1.0f - t;
+	return 1.0f - u * u * u;
+}
+
+// bottom left of something part way (t = 0..1) between two tiles
+static void tile_position(f32 *x, f32 *y, int from, int to, f32 t) {
+	f32 col = from % 8 + (to % 8 - from % 8) * t;
+	f32 row = from / 8 + (to / 8 - from / 8) * t;
+	*x = BOARD_OFFSET_X + col * BOARD_TILE_SIZE;
+	*y = BOARD_OFFSET_Y + row * BOARD_TILE_SIZE;
+}
+
+// where whatever an event of this type and value is about was before the
+// move, index (where it is now) when it didn't move or wasn't shown
+static int moved_from(const Move_Events *events, Move_Event_Type type, int value, int index) {
+	for (u32 i = 0; i < events->count; ++i) {
+		const Move_Event *event = &events->events[i];
+		if (event->type == type && event->value == value)
+			return event->from >= 0 ? event->from : index;
+	}
+	return index;
+}
+
+// A to B through every visible link as one line strip, widened into quads
+// by line.geom, so a longer chain is still one upload and one draw
+static void render_chain(const Snapshot *snapshot, f32 t) {
+	const State *current = &snapshot->current;
+	const Move_Events *events = &snapshot->events;
+	if (current->player_a_index == current->player_b_index)
+		return;
+
+	int from[4];
+	int to[4];
+	int count = 0;
+	from[count] = moved_from(events, MOVE_EVENT_MOVED, ENTITY_TYPE_PLAYER_A, current->player_a_index);
+	to[count++] = current->player_a_index;
 	for (int i = 0; i < 2; ++i) {
-		if (state.chain_indices[i] != -1 && state.chain_visible[i]) {
-			int index = state.chain_indices[i];
-			int col = index % 8;
-			int row = index / 8;
-			render_square(
-				BOARD_OFFSET_X + col * BOARD_TILE_SIZE + 6,
-				BOARD_OFFSET_Y + row * BOARD_TILE_SIZE + 6,
-				BOARD_TILE_SIZE / 4,
-				BOARD_TILE_SIZE / 4,
-				color_white
-			);
-		}
-	}
-}
-
-static void render_tile(int col, int row, Tile tile) {
-	f32 x = BOARD_OFFSET_X + col * BOARD_TILE_SIZE;
-	f32 y = BOARD_OFFSET_Y + row * BOARD_TILE_SIZE;
-	switch (tile.type) {
-	case TILE_TYPE_NORMAL: {
-	} break;
-	case TILE_TYPE_WATER: {
-		render_square(x, y, BOARD_TILE_SIZE, BOARD_TILE_SIZE, color_water);
-	} break;
-	case TILE_TYPE_WALL: {
-		render_square(x, y, BOARD_TILE_SIZE, BOARD_TILE_SIZE, color_white);
-	} break;
-	case TILE_TYPE_GOAL: {
-		if (state.exit_open) {
-			render_square(x, y, BOARD_TILE_SIZE, BOARD_TILE_SIZE, color_goal);
-		} else {
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-			render_square(x, y, BOARD_TILE_SIZE, BOARD_TILE_SIZE, color_goal);
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		if (current->chain_indices[i] != -1 && current->chain_visible[i]) {
+			int index = current->chain_indices[i];
+			from[count] = moved_from(events, MOVE_EVENT_CHAIN, i, index);
+			to[count++] = index;
 		}
-	} break;
+	}
+	from[count] = moved_from(events, MOVE_EVENT_MOVED, ENTITY_TYPE_PLAYER_B, current->player_b_index);
+	to[count++] = current->player_b_index;
+
+	f32 points[4][2];
+	for (int i = 0; i < count; ++i) {
+		tile_position(&points[i][0], &points[i][1], from[i], to[i], t);
+		points[i][0] += BOARD_TILE_SIZE / 2;
+		points[i][1] += BOARD_TILE_SIZE / 2;
 	}
 
-	render_entity(x, y, tile.entity);
+	u32 start = stream_upload(points, count * sizeof(points[0]), sizeof(points[0]));
+	use_program(line_shader);
+	bind_vertex_array(line_vao);
+	glDrawArrays(GL_LINE_STRIP, start / sizeof(points[0]), count);
+	++render_cache.calls;
+	++render_cache.draws;
 }
 
+// tiles, outlines, the goal and collectables all come from one quad
 static void render_board() {
-	for (int x = 0; x < 8; ++x) {
-		for (int y = 0; y < 8; ++y) {
-			render_square(
-				BOARD_OFFSET_X + x * BOARD_TILE_SIZE,
-				BOARD_OFFSET_Y + y * BOARD_TILE_SIZE,
-				BOARD_TILE_SIZE,
-				BOARD_TILE_SIZE,
-				color_tile_outline
-			);
-			render_square(
-				BOARD_OFFSET_X + x * BOARD_TILE_SIZE + 1,
-				BOARD_OFFSET_Y + y * BOARD_TILE_SIZE + 1,
-				BOARD_TILE_SIZE - 2,
-				BOARD_TILE_SIZE - 2,
-				color_tile_fill
-			);
-				// (y + x) % 2 == 0 ? color_tile_a : color_tile_b
-			render_tile(x, y, state.tiles[y * 8 + x]);
-		}
-	}
-}
-
-static void render_score() {
+	use_program(board_shader);
+	bind_texture(board_texture);
+	bind_vertex_array(square_vao);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	++render_cache.calls;
+	++render_cache.draws;
+}
+
+// drawn after the board so moving entities slide over the tiles. same
+// squares as a still frame, just in between positions
+static void render_entities(const Snapshot *snapshot, f32 t) {
+	const State *current = &snapshot->current;
+	const Move_Events *events = &snapshot->events;
+	int previous_a = moved_from(events, MOVE_EVENT_MOVED, ENTITY_TYPE_PLAYER_A, current->player_a_index);
+	int previous_b = moved_from(events, MOVE_EVENT_MOVED, ENTITY_TYPE_PLAYER_B, current->player_b_index);
+	f32 x, y;
+
+	// the block A pushed this move, if any. it may have sunk into water
+	int pushed_from = -1;
+	int pushed_to = -1;
+	for (u32 i = 0; i < events->count; ++i) {
+		const Move_Event *event = &events->events[i];
+		if (event->type == MOVE_EVENT_MOVED && event->value == ENTITY_TYPE_BLOCK) {
+			pushed_from = event->from;
+			pushed_to = event->to;
+		}
+	}
+
+	for (int i = 0; i < 64; ++i) {
+		Entity_Type entity = current->tiles[i].entity;
+		switch (entity) {
+		case ENTITY_TYPE_PLAYER_A: {
+			tile_position(&x, &y, previous_a, i, t);
+			render_entity(x, y, ENTITY_TYPE_PLAYER_A);
+		} break;
+		case ENTITY_TYPE_PLAYER_B: {
+			tile_position(&x, &y, previous_b, i, t);
+			render_entity(x, y, ENTITY_TYPE_PLAYER_B);
+		} break;
+		case ENTITY_TYPE_PLAYER_BOTH: {
+			tile_position(&x, &y, previous_b, i, t);
+			render_entity(x, y, ENTITY_TYPE_PLAYER_B);
+			tile_position(&x, &y, previous_a, i, t);
+			render_entity(x, y, ENTITY_TYPE_PLAYER_A);
+		} break;
+		// drawn with the board
+		case ENTITY_TYPE_COLLECTABLE: break;
+		default: {
+			tile_position(&x, &y, i == pushed_to ? pushed_from : i, i, t);
+			render_entity(x, y, entity);
+		} break;
+		}
+	}
+
+	if (pushed_to >= 0 && current->tiles[pushed_to].entity != ENTITY_TYPE_BLOCK && t < 1.0f) {
+		tile_position(&x, &y, pushed_from, pushed_to, t);
+		render_entity(x, y, ENTITY_TYPE_BLOCK);
+	}
+}
+
+static void render_score(const State *s) {
 	int x = BOARD_TILE_SIZE;
 	int y = HEIGHT - BOARD_TILE_SIZE * 2;
-	for (int i = 0; i < state.collectable_count; ++i) {
-    		if (state.collected > i) {
+	for (int i = 0; i < s->collectable_count; ++i) {
+    		if (s->collected > i) {
         		render_square(x + 6, y + 6, BOARD_TILE_SIZE / 4, BOARD_TILE_SIZE / 4, color_green);
     		} else {
         		render_square(x + 6, y + 6, BOARD_TILE_SIZE / 4, BOARD_TILE_SIZE / 4, color_green);
@@ -687,33 +2285,1516 @@ static void render_score() {
 	}
 }
 
-static void render() {
-	glfwPollEvents();
+// true if any of events could have changed the static layer
+static bool changes_tiles(const Move_Events *events) {
+	for (u32 i = 0; i < events->count; ++i) {
+		if (events->events[i].type != MOVE_EVENT_MOVED && events->events[i].type != MOVE_EVENT_CHAIN)
+			return true;
+	}
+	return false;
+}
+
+// everything that only changes when a tile does: background, board and
+// score. redrawn into static_fbo when its key changes, otherwise just copied
+// into the scene. a move whose events only moved things is skipped without
+// building the key, unless the render thread missed a snapshot in between
+static void render_static_layer(const Snapshot *snapshot) {
+	const State *s = &snapshot->current;
+	u32 revision = snapshot->revision;
+	if (revision == static_layer_revision)
+		return;
+	bool skipped = revision != static_layer_revision + 1;
+	static_layer_revision = revision;
+	if (static_layer_valid && !skipped && !changes_tiles(&snapshot->events))
+		return;
+
+	Static_Layer_Key key = {0};
+	for (int i = 0; i < 64; ++i) {
+		key.codes[i][0] = s->tiles[i].type;
+		if (s->tiles[i].entity == ENTITY_TYPE_COLLECTABLE)
+			key.codes[i][1] = ENTITY_TYPE_COLLECTABLE;
+	}
+	key.collected = s->collected;
+	key.collectable_count = s->collectable_count;
+	key.exit_open = s->exit_open;
+	if (static_layer_valid && memcmp(&key, &static_layer_key, sizeof(Static_Layer_Key)) == 0)
+		return;
+	static_layer_key = key;
+	static_layer_valid = true;
+
+	bind_texture(board_texture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 8, 8, GL_RG_INTEGER, GL_UNSIGNED_BYTE, key.codes);
+	use_program(board_shader);
+	glUniform1i(exit_open_location, key.exit_open);
+
+	bind_framebuffer(GL_FRAMEBUFFER, static_fbo);
 	glClearColor(color_bg[0], color_bg[1], color_bg[2], color_bg[3]);
 	glClear(GL_COLOR_BUFFER_BIT);
-
-	glUseProgram(shader);
-	glUniformMatrix4fv(glGetUniformLocation(shader, "projection"), 1, GL_FALSE, &projection[0][0]);
+	render_cache.calls += 4;
+	++render_cache.uniforms;
 
 	render_board();
-	render_chain();
-	render_score();
+	render_score(s);
+	flush_batch();
+}
+
+static int compare_f64(const void *a, const void *b) {
+	f64 x = *(const f64 *)a;
+	f64 y = *(const f64 *)b;
+	return x < y ? -1 : x > y;
+}
 
+// p50, p95 and p99 over the stats window of the f64 at offset in
+// Frame_Sample. unknown (negative) values are left out, all -1 if that's all
+static void frame_percentiles(size_t offset, f64 out[3]) {
+	static f64 values[FRAME_STATS_WINDOW];
+	u64 frames = frame_stats.count < FRAME_STATS_WINDOW ? frame_stats.count : FRAME_STATS_WINDOW;
+	int count = 0;
+	for (u64 i = 0; i < frames; ++i) {
+		f64 value = *(const f64 *)((const u8 *)&frame_stats.samples[i] + offset);
+		if (value >= 0)
+			values[count++] = value;
+	}
+	const f64 points[3] = { 0.50, 0.95, 0.99 };
+	qsort(values, count, sizeof(f64), compare_f64);
+	for (int i = 0; i < 3; ++i)
+		out[i] = count ? values[(int)(points[i] * (count - 1) + 0.5)] : -1;
+}
+
+// opens the frame log, json if the name ends in .json and csv otherwise
+static void start_frame_stats(const char *log_path) {
+	frame_stats.hud = true;
+	if (!log_path)
+		return;
+	frame_stats.log = fopen(log_path, "w");
+	if (!frame_stats.log)
+		error_and_exit(-1, "Can't write frame log");
+	const char *extension = strrchr(log_path, '.');
+	frame_stats.json = extension && strcmp(extension, ".json") == 0;
+	if (frame_stats.json)
+		fprintf(frame_stats.log, "{\"frames\": [");
+	else
+		fprintf(frame_stats.log, "frame,cpu_ms,swap_ms,gpu_ms,calls,draws,uniforms,moves,bfs_runs\n");
+}
+
+static void write_frame_sample(u64 frame) {
+	const Frame_Sample *sample = &frame_stats.samples[frame % FRAME_STATS_WINDOW];
+	char gpu[32] = "";
+	if (sample->gpu_ms >= 0)
+		snprintf(gpu, sizeof(gpu), "%.3f", sample->gpu_ms);
+	if (frame_stats.json) {
+		fprintf(frame_stats.log, "%s\n{\"frame\": %llu, \"cpu_ms\": %.3f, \"swap_ms\": %.3f, \"gpu_ms\": %s, "
+			"\"calls\": %u, \"draws\": %u, \"uniforms\": %u, \"moves\": %u, \"bfs_runs\": %u}",
+			frame ? "," : "", (unsigned long long)frame, sample->cpu_ms, sample->swap_ms, gpu[0] ? gpu : "null",
+			sample->calls, sample->draws, sample->uniforms, sample->moves, sample->bfs_runs);
+	} else {
+		fprintf(frame_stats.log, "%llu,%.3f,%.3f,%s,%u,%u,%u,%u,%u\n",
+			(unsigned long long)frame, sample->cpu_ms, sample->swap_ms, gpu,
+			sample->calls, sample->draws, sample->uniforms, sample->moves, sample->bfs_runs);
+	}
+}
+
+// a query comes back FRAME_QUERIES frames after it was issued, so that is
+// how far behind the gpu column, and the log rows waiting for it, run
+static void read_frame_query(int slot) {
+	if (!frame_stats.query_pending[slot])
+		return;
+	GLuint64 elapsed;
+	glGetQueryObjectui64v(frame_stats.queries[slot], GL_QUERY_RESULT, &elapsed);
+	// llvmpipe has been seen to time its very first query from boot
+	if (elapsed / 1e6 <= now_ms() - frame_stats.query_starts[slot])
+		frame_stats.samples[frame_stats.query_frames[slot] % FRAME_STATS_WINDOW].gpu_ms = elapsed / 1e6;
+	frame_stats.query_pending[slot] = false;
+	++render_cache.calls;
+}
+
+static void begin_frame_stats() {
+	frame_stats.samples[frame_stats.count % FRAME_STATS_WINDOW] = (Frame_Sample){ .gpu_ms = -1 };
+	if (!frame_stats.timer_queries || !(frame_stats.hud || frame_stats.log))
+		return;
+	int slot = frame_stats.count % FRAME_QUERIES;
+	read_frame_query(slot);
+	glBeginQuery(GL_TIME_ELAPSED, frame_stats.queries[slot]);
+	frame_stats.query_frames[slot] = frame_stats.count;
+	frame_stats.query_starts[slot] = now_ms();
+	frame_stats.query_pending[slot] = true;
+	frame_stats.query_active = true;
+	++render_cache.calls;
+}
+
+static void end_frame_stats(f64 cpu_ms, f64 swap_ms) {
+	Frame_Sample *sample = &frame_stats.samples[frame_stats.count % FRAME_STATS_WINDOW];
+	u32 moves = atomic_load_explicit(&moves_made, memory_order_relaxed);
+	u32 runs = atomic_load_explicit(&bfs_runs, memory_order_relaxed);
+	sample->cpu_ms = cpu_ms;
+	sample->swap_ms = swap_ms;
+	sample->calls = render_cache.calls;
+	sample->draws = render_cache.draws;
+	sample->uniforms = render_cache.uniforms;
+	sample->moves = moves - frame_stats.last_moves;
+	sample->bfs_runs = runs - frame_stats.last_bfs_runs;
+	frame_stats.last_moves = moves;
+	frame_stats.last_bfs_runs = runs;
+
+	if (frame_stats.log && frame_stats.count >= FRAME_QUERIES)
+		write_frame_sample(frame_stats.count - FRAME_QUERIES);
+	++frame_stats.count;
+
+	// sorting the window every frame isn't worth it for the hud
+	f64 now = glfwGetTime();
+	if (frame_stats.hud && now - frame_stats.percentile_time > 0.5) {
+		frame_percentiles(offsetof(Frame_Sample, cpu_ms), frame_stats.cpu_percentiles);
+		frame_percentiles(offsetof(Frame_Sample, gpu_ms), frame_stats.gpu_percentiles);
+		frame_stats.percentile_time = now;
+	}
+}
+
+// stats or latency being watched, the only time instrumentation prints
+static bool watching() {
+	return frame_stats.hud || frame_stats.log || latency_stats.enabled;
+}
+
+// collects the last queries, writes the rows still waiting for them and
+// closes the log. prints p50/p95/p99 if anything was being watched
+static void finish_frame_stats() {
+	if (!frame_stats.hud && !frame_stats.log)
+		return;
+	for (int i = 0; i < FRAME_QUERIES; ++i)
+		read_frame_query(i);
+
+	f64 cpu[3], swap[3], gpu[3];
+	frame_percentiles(offsetof(Frame_Sample, cpu_ms), cpu);
+	frame_percentiles(offsetof(Frame_Sample, swap_ms), swap);
+	frame_percentiles(offsetof(Frame_Sample, gpu_ms), gpu);
+	printf("last %d frames p50/p95/p99: cpu %.2f/%.2f/%.2f ms, swap %.2f/%.2f/%.2f ms, gpu %.2f/%.2f/%.2f ms\n",
+		(int)(frame_stats.count < FRAME_STATS_WINDOW ? frame_stats.count : FRAME_STATS_WINDOW),
+		cpu[0], cpu[1], cpu[2], swap[0], swap[1], swap[2], gpu[0], gpu[1], gpu[2]);
+
+	if (!frame_stats.log)
+		return;
+	u64 first = frame_stats.count > FRAME_QUERIES ? frame_stats.count - FRAME_QUERIES : 0;
+	for (u64 frame = first; frame < frame_stats.count; ++frame)
+		write_frame_sample(frame);
+	if (frame_stats.json) {
+		fprintf(frame_stats.log, "\n],\n\"window\": %d, \"cpu_ms\": [%.3f, %.3f, %.3f], \"swap_ms\": [%.3f, %.3f, %.3f], "
+			"\"gpu_ms\": [%.3f, %.3f, %.3f]}\n", FRAME_STATS_WINDOW,
+			cpu[0], cpu[1], cpu[2], swap[0], swap[1], swap[2], gpu[0], gpu[1], gpu[2]);
+	}
+	fclose(frame_stats.log);
+	frame_stats.log = NULL;
+}
+
+static void count_latency(Latency_Stage stage, f64 seconds) {
+	int bucket = seconds * 1000.0 / LATENCY_BUCKET_MS;
+	if (bucket < 0)
+		bucket = 0;
+	if (bucket >= LATENCY_BUCKETS)
+		bucket = LATENCY_BUCKETS - 1;
+	++latency_stats.counts[stage][bucket];
+}
+
+// every traced move up to the revision that was just swapped in made it
+// to the screen with this frame
+static void record_latency(u32 revision, f64 frame_start, f64 swapped) {
+	for (;;) {
+		if (!latency_stats.has_pending && !input_pop(&trace_queue, &latency_stats.pending))
+			return;
+		latency_stats.has_pending = true;
+		Input_Event *event = &latency_stats.pending;
+		if ((i32)(event->revision - revision) > 0)
+			return;
+		latency_stats.has_pending = false;
+
+		// the frame that picked the move up started after it was published
+		f64 frame_from = frame_start > event->move_end ? frame_start : event->move_end;
+		f64 times[LATENCY_STAGES] = {
+			[LATENCY_QUEUE] = event->move_start - event->time,
+			[LATENCY_MOVE] = event->move_end - event->move_start,
+			[LATENCY_WAIT] = frame_from - event->move_end,
+			[LATENCY_FRAME] = swapped - frame_from,
+			[LATENCY_TOTAL] = swapped - event->time,
+		};
+		for (int stage = 0; stage < LATENCY_STAGES; ++stage)
+			count_latency(stage, times[stage]);
+		++latency_stats.inputs;
+		printf("input %u: %.1f ms (queue %.1f, move %.2f, wait %.1f, frame %.1f)\n", latency_stats.inputs,
+			times[LATENCY_TOTAL] * 1000.0, times[LATENCY_QUEUE] * 1000.0, times[LATENCY_MOVE] * 1000.0,
+			times[LATENCY_WAIT] * 1000.0, times[LATENCY_FRAME] * 1000.0);
+	}
+}
+
+// percentiles are read off the histograms, so good to LATENCY_BUCKET_MS
+static void print_latency() {
+	static const char *names[LATENCY_STAGES] = { "queue", "move", "wait", "frame", "total" };
+	if (!latency_stats.enabled || latency_stats.inputs == 0)
+		return;
+	printf("input to photon over %u inputs, p50/p95/p99 in ms:\n", latency_stats.inputs);
+	for (int stage = 0; stage < LATENCY_STAGES; ++stage) {
+		const f64 points[3] = { 0.50, 0.95, 0.99 };
+		char found[3][16];
+		for (int i = 0; i < 3; ++i) {
+			u32 needed = (u32)(points[i] * latency_stats.inputs + 0.999);
+			u32 seen = 0;
+			int bucket = 0;
+			while (bucket < LATENCY_BUCKETS - 1 && (seen += latency_stats.counts[stage][bucket]) < needed)
+				++bucket;
+			if (bucket == LATENCY_BUCKETS - 1)
+				snprintf(found[i], sizeof(found[i]), ">%d", bucket * LATENCY_BUCKET_MS);
+			else
+				snprintf(found[i], sizeof(found[i]), "<%d", (bucket + 1) * LATENCY_BUCKET_MS);
+		}
+		printf("  %-5s %s/%s/%s\n", names[stage], found[0], found[1], found[2]);
+	}
+	if (input_queue.dropped || trace_queue.dropped)
+		printf("  dropped with the queue full: %u inputs, %u traces\n", input_queue.dropped, trace_queue.dropped);
+
+	u32 most = 1;
+	for (int bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+		if (latency_stats.counts[LATENCY_TOTAL][bucket] > most)
+			most = latency_stats.counts[LATENCY_TOTAL][bucket];
+	}
+	for (int bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+		u32 count = latency_stats.counts[LATENCY_TOTAL][bucket];
+		if (count == 0)
+			continue;
+		char bar[41];
+		int width = (int)((u64)count * 40 / most);
+		memset(bar, '#', width);
+		bar[width] = 0;
+		if (bucket == LATENCY_BUCKETS - 1)
+			printf("  %3d+    ms %6u %s\n", bucket * LATENCY_BUCKET_MS, count, bar);
+		else
+			printf("  %3d-%-3d ms %6u %s\n", bucket * LATENCY_BUCKET_MS, (bucket + 1) * LATENCY_BUCKET_MS, count, bar);
+	}
+}
+
+static f32 hud_clamp(f32 value, f32 limit) {
+	return value < 0 ? 0 : value > limit ? limit : value;
+}
+
+// frame times of the last HUD_GRAPH_FRAMES frames in the top right corner,
+// cpu time under the time spent in swap, with a line at 60hz halfway up.
+// p50/p95/p99 of cpu time are marked on the left edge and of gpu time on
+// the right. under it a bar per counter, a pixel per count: this frame's
+// draws and uniform uploads, then moves and bfs runs over the graph
+static void render_frame_graph() {
+	f32 x = WIDTH - HUD_GRAPH_FRAMES - 4;
+	f32 y = HEIGHT - HUD_GRAPH_HEIGHT - 4;
+	f32 per_ms = HUD_GRAPH_HEIGHT / (2 * 1000.0f / 60.0f);
+	render_square(x, y, HUD_GRAPH_FRAMES, HUD_GRAPH_HEIGHT, color_tile_fill);
+
+	u32 moves = 0;
+	u32 runs = 0;
+	for (int i = 0; i < HUD_GRAPH_FRAMES && (u64)i < frame_stats.count; ++i) {
+		const Frame_Sample *sample = &frame_stats.samples[(frame_stats.count - 1 - i) % FRAME_STATS_WINDOW];
+		moves += sample->moves;
+		runs += sample->bfs_runs;
+	}
+	const Frame_Sample *last = &frame_stats.samples[(frame_stats.count + FRAME_STATS_WINDOW - 1) % FRAME_STATS_WINDOW];
+	u32 counters[4] = { last->draws, last->uniforms, moves, runs };
+	f32 *colors[4] = { color_orange, color_salmon, color_green, color_water };
+	for (int i = 0; i < 4; ++i) {
+		f32 bar_y = y - (i + 1) * (HUD_BAR_HEIGHT + 1);
+		render_square(x, bar_y, HUD_GRAPH_FRAMES, HUD_BAR_HEIGHT, color_tile_fill);
+		render_square(x, bar_y, hud_clamp(counters[i], HUD_GRAPH_FRAMES), HUD_BAR_HEIGHT, colors[i]);
+	}
+	for (int i = 0; i < 3; ++i) {
+		if (frame_stats.cpu_percentiles[i] >= 0)
+			render_square(x - 3, y + hud_clamp(frame_stats.cpu_percentiles[i] * per_ms, HUD_GRAPH_HEIGHT - 1), 3, 1, color_orange);
+		if (frame_stats.gpu_percentiles[i] >= 0)
+			render_square(x + HUD_GRAPH_FRAMES, y + hud_clamp(frame_stats.gpu_percentiles[i] * per_ms, HUD_GRAPH_HEIGHT - 1), 3, 1, color_green);
+	}
+	for (int i = 0; i < HUD_GRAPH_FRAMES && (u64)i < frame_stats.count; ++i) {
+		const Frame_Sample *sample = &frame_stats.samples[(frame_stats.count - 1 - i) % FRAME_STATS_WINDOW];
+		f32 cpu = sample->cpu_ms * per_ms;
+		f32 swap = sample->swap_ms * per_ms;
+		if (cpu > HUD_GRAPH_HEIGHT)
+			cpu = HUD_GRAPH_HEIGHT;
+		if (cpu + swap > HUD_GRAPH_HEIGHT)
+			swap = HUD_GRAPH_HEIGHT - cpu;
+		f32 bar_x = x + HUD_GRAPH_FRAMES - 1 - i;
+		render_square(bar_x, y, 1, cpu, color_orange);
+		render_square(bar_x, y + cpu, 1, swap, color_water);
+	}
+	render_square(x, y + HUD_GRAPH_HEIGHT / 2, HUD_GRAPH_FRAMES, 1, color_white);
+}
+
+// the whole frame at game resolution, into scene_fbo
+static void render_scene(const Snapshot *snapshot, f32 t) {
+	stream_begin_frame();
+
+	render_static_layer(snapshot);
+
+	bind_framebuffer(GL_READ_FRAMEBUFFER, static_fbo);
+	bind_framebuffer(GL_DRAW_FRAMEBUFFER, scene_fbo);
+	glBlitFramebuffer(0, 0, WIDTH, HEIGHT, 0, 0, WIDTH, HEIGHT, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	++render_cache.calls;
+
+	// under the entities, so it looks tied to them
+	render_chain(snapshot, t);
+	render_entities(snapshot, t);
+	if (frame_stats.hud)
+		render_frame_graph();
+	flush_batch();
+
+	stream_end_frame();
+}
+
+static void render(const Snapshot *snapshot) {
+	f64 start = now_ms();
+	u64 allocated = thread_allocations;
+	f64 frame_start = glfwGetTime();
+	begin_frame_stats();
+	f32 t = (glfwGetTime() - snapshot->move_time) / MOVE_DURATION;
+	t = ease_out(t < 0.0f ? 0.0f : t > 1.0f ? 1.0f : t);
+
+	render_scene(snapshot, t);
+
+	// one nearest blit to the window, so every game pixel becomes the same
+	// size square whatever the monitor is
+	bind_framebuffer(GL_READ_FRAMEBUFFER, scene_fbo);
+	bind_framebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glBlitFramebuffer(0, 0, WIDTH, HEIGHT,
+		present_x, present_y, present_x + present_width, present_y + present_height,
+		GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	render_cache.calls += 3;
+	if (frame_stats.query_active) {
+		glEndQuery(GL_TIME_ELAPSED);
+		frame_stats.query_active = false;
+		++render_cache.calls;
+	}
+
+	f64 swap_start = now_ms();
 	glfwSwapBuffers(window);
+	++render_cache.calls;
+	f64 swap_end = now_ms();
+	if (latency_stats.enabled)
+		record_latency(snapshot->revision, frame_start, glfwGetTime());
+	if (render_cache.frames == 0 && watching())
+		printf("first frame after %.1f ms, %.2f ms of it loading gl\n", swap_end - startup_time, gl_load_time);
+
+	end_frame_stats(swap_start - start, swap_end - swap_start);
+	count_frame_allocations(thread_allocations - allocated);
+	render_cache.total_calls += render_cache.calls;
+	render_cache.calls = 0;
+	render_cache.draws = 0;
+	render_cache.uniforms = 0;
+	++render_cache.frames;
+}
+
+// headless replay: plays a move list on one level and writes every frame,
+// in between positions included, as y4m to stdout. renders into an egl
+// surfaceless context, so no window or display, and as fast as it can
+#ifdef __linux__
+typedef struct video {
+	u32 fbo;
+	u32 texture;
+	int width;
+	int height;
+	u32 pbos[2];
+	u32 frames;
+	u8 *planes;
+} Video;
+
+static void setup_headless() {
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (!get_platform_display)
+		error_and_exit(-1, "EGL can't pick a platform");
+	EGLDisplay display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+		error_and_exit(-1, "Failed to init surfaceless EGL");
+
+	// no surface is ever made, but the default would ask for window configs
+	EGLint config_attributes[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config;
+	EGLint config_count;
+	if (!eglChooseConfig(display, config_attributes, &config, 1, &config_count) || config_count < 1)
+		error_and_exit(-1, "No EGL config for desktop GL");
+
+	eglBindAPI(EGL_OPENGL_API);
+	EGLint context_attributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+		error_and_exit(-1, "Failed to create headless context");
+
+	load_gl((GLADloadproc)eglGetProcAddress);
+	glViewport(0, 0, WIDTH, HEIGHT);
+}
+
+// bt.601 limited range, no chroma subsampling so tile edges stay sharp
+static void video_write(Video *video, const u8 *rgba) {
+	int size = video->width * video->height;
+	u8 *y_plane = video->planes;
+	u8 *u_plane = y_plane + size;
+	u8 *v_plane = u_plane + size;
+	for (int row = 0; row < video->height; ++row) {
+		// gl rows go bottom up
+		const u8 *pixel = rgba + (video->height - 1 - row) * video->width * 4;
+		for (int x = 0; x < video->width; ++x, pixel += 4) {
+			int r = pixel[0], g = pixel[1], b = pixel[2];
+			int i = row * video->width + x;
+			y_plane[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+			u_plane[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+			v_plane[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+		}
+	}
+	fputs("FRAME\n", stdout);
+	fwrite(video->planes, 1, size * 3, stdout);
+}
+
+// frame n is read into one pbo while frame n - 1 is copied out of the other,
+// so glReadPixels only queues a copy and never waits for the gpu
+static void video_readback(Video *video, u32 frame) {
+	u32 pbo = video->pbos[frame & 1];
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+	u8 *rgba = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, video->width * video->height * 4, GL_MAP_READ_BIT);
+	if (!rgba)
+		error_and_exit(-1, "Failed to map readback buffer");
+	video_write(video, rgba);
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+static void video_frame(Video *video, const Snapshot *snapshot, f32 t) {
+	render_scene(snapshot, t);
+
+	u32 source = scene_fbo;
+	if (video->fbo) {
+		bind_framebuffer(GL_READ_FRAMEBUFFER, scene_fbo);
+		bind_framebuffer(GL_DRAW_FRAMEBUFFER, video->fbo);
+		glBlitFramebuffer(0, 0, WIDTH, HEIGHT, 0, 0, video->width, video->height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		source = video->fbo;
+	}
+	bind_framebuffer(GL_READ_FRAMEBUFFER, source);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, video->pbos[video->frames & 1]);
+	glReadPixels(0, 0, video->width, video->height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	if (video->frames > 0)
+		video_readback(video, video->frames - 1);
+	++video->frames;
+}
+
+static int replay(int level, const char *moves_path, int scale) {
+	if (level < 0 || level >= (int)(sizeof(levels) / sizeof(levels[0])))
+		error_and_exit(-1, "No such level");
+	if (scale < 1)
+		scale = 1;
+	char *moves = read_file_into_buffer(moves_path);
+
+	f64 start = now_ms();
+
+	setup_headless();
+	setup_rendering();
+	setup_shaders();
+
+	Video video = {0};
+	video.width = WIDTH * scale;
+	video.height = HEIGHT * scale;
+	if (scale > 1)
+		create_render_target(&video.fbo, &video.texture, video.width, video.height);
+	glGenBuffers(2, video.pbos);
+	for (int i = 0; i < 2; ++i) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, video.pbos[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, video.width * video.height * 4, NULL, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	video.planes = malloc(video.width * video.height * 3);
+	if (!video.planes)
+		error_and_exit(-1, "Can't allocate video frame");
+
+	static char stdout_buffer[1 << 20];
+	setvbuf(stdout, stdout_buffer, _IOFBF, sizeof(stdout_buffer));
+	printf("YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", video.width, video.height, REPLAY_FPS);
+
+	load_level(level);
+	static Snapshot snapshot;
+	memcpy(&snapshot.current, &state, sizeof(State));
+	snapshot.revision = 1;
+	for (int i = 0; i < REPLAY_HOLD_FRAMES; ++i)
+		video_frame(&video, &snapshot, 1.0f);
+
+	// the same pace as the game, one move per MOVE_DURATION
+	int move_frames = (int)(MOVE_DURATION * REPLAY_FPS + 0.5);
+	for (char *move = moves; *move; ++move) {
+		int direction;
+		switch (*move) {
+		case 'L': direction = LEFT; break;
+		case 'R': direction = RIGHT; break;
+		case 'U': direction = UP; break;
+		case 'D': direction = DOWN; break;
+		case ' ': case '\t': case '\r': case '\n': continue;
+		default: error_and_exit(-1, "Moves are L, R, U and D");
+		}
+
+		Move_Result result = try_move(direction, state.player_a_index, &snapshot.events);
+		memcpy(&snapshot.current, &state, sizeof(State));
+		++snapshot.revision;
+		for (int i = 1; i <= move_frames; ++i)
+			video_frame(&video, &snapshot, ease_out((f32)i / move_frames));
+
+		if (result == MOVE_RESULT_LEVEL_COMPLETE)
+			break;
+		// same as player_move, straight back to the start
+		if (result == MOVE_RESULT_DIED || is_dead_state()) {
+			reloaded(&snapshot.events, result == MOVE_RESULT_DIED ? MOVE_EVENT_DIED : MOVE_EVENT_RESTARTED);
+			load_level(level);
+			memcpy(&snapshot.current, &state, sizeof(State));
+			++snapshot.revision;
+		}
+	}
+
+	for (int i = 0; i < REPLAY_HOLD_FRAMES; ++i)
+		video_frame(&video, &snapshot, 1.0f);
+	video_readback(&video, video.frames - 1);
+	fflush(stdout);
+
+	f64 ms = now_ms() - start;
+	fprintf(stderr, "%u frames in %.1f ms, %.1fx real time\n",
+		video.frames, ms, video.frames * 1000.0 / REPLAY_FPS / ms);
+	free(video.planes);
+	free(moves);
+	return 0;
+}
+#endif
+
+// software renderer: the picture render() settles on once nothing is
+// moving, drawn on the cpu into a WIDTH x HEIGHT buffer for machines with
+// no gpu. everything in it is an axis aligned rectangle
+typedef struct soft_target {
+	u32 pixels[WIDTH * HEIGHT];
+} Soft_Target;
+
+static u32 soft_color(const vec4 color) {
+	u32 packed = 0;
+	for (int i = 0; i < 4; ++i)
+		packed |= (u32)(color[i] * 255.0f + 0.5f) << (i * 8);
+	return packed;
+}
+
+static void soft_fill_span(u32 *span, int count, u32 color) {
+	int i = 0;
+#ifdef __SSE2__
+	__m128i wide = _mm_set1_epi32((int)color);
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_si128((__m128i *)&span[i], wide);
+#endif
+	for (; i < count; ++i)
+		span[i] = color;
+}
+
+// same coordinates as render_square, y up from the bottom
+static void soft_fill(Soft_Target *target, int x, int y, int width, int height, const vec4 color) {
+	int x0 = x < 0 ? 0 : x;
+	int y0 = y < 0 ? 0 : y;
+	int x1 = x + width > WIDTH ? WIDTH : x + width;
+	int y1 = y + height > HEIGHT ? HEIGHT : y + height;
+	if (x0 >= x1)
+		return;
+	u32 packed = soft_color(color);
+	for (int row = y0; row < y1; ++row)
+		soft_fill_span(&target->pixels[(HEIGHT - 1 - row) * WIDTH + x0], x1 - x0, packed);
+}
+
+// board.frag, one tile at a time
+static void soft_tile(Soft_Target *target, const State *s, int index) {
+	int x = BOARD_OFFSET_X + index % 8 * BOARD_TILE_SIZE;
+	int y = BOARD_OFFSET_Y + index / 8 * BOARD_TILE_SIZE;
+	int size = BOARD_TILE_SIZE;
+	switch (s->tiles[index].type) {
+	case TILE_TYPE_WALL: soft_fill(target, x, y, size, size, color_white); break;
+	case TILE_TYPE_WATER: soft_fill(target, x, y, size, size, color_water); break;
+	case TILE_TYPE_GOAL: {
+		if (s->exit_open) {
+			soft_fill(target, x, y, size, size, color_goal);
+			break;
+		}
+		soft_fill(target, x, y, size, size, color_tile_outline);
+		soft_fill(target, x + 1, y + 1, size - 2, size - 2, color_tile_fill);
+		soft_fill(target, x, y, size, 1, color_goal);
+		soft_fill(target, x, y + size - 1, size, 1, color_goal);
+		soft_fill(target, x, y, 1, size, color_goal);
+		soft_fill(target, x + size - 1, y, 1, size, color_goal);
+		for (int i = 0; i < size; ++i)
+			soft_fill(target, x + i, y + size - 1 - i, 1, 1, color_goal);
+	} break;
+	case TILE_TYPE_ICE: {
+		soft_fill(target, x, y, size, size, color_tile_outline);
+		soft_fill(target, x + 1, y + 1, size - 2, size - 2, color_ice);
+	} break;
+	case TILE_TYPE_SNOW: {
+		soft_fill(target, x, y, size, size, color_tile_outline);
+		soft_fill(target, x + 1, y + 1, size - 2, size - 2, color_snow);
+	} break;
+	default: {
+		soft_fill(target, x, y, size, size, color_tile_outline);
+		soft_fill(target, x + 1, y + 1, size - 2, size - 2, color_tile_fill);
+	} break;
+	}
+
+	if (s->tiles[index].entity == ENTITY_TYPE_COLLECTABLE)
+		soft_fill(target, x + 6, y + 6, size / 4, size / 4, color_green);
+}
+
+static void soft_entity(Soft_Target *target, int x, int y, Entity_Type type) {
+	switch (type) {
+	case ENTITY_TYPE_PLAYER_A: soft_fill(target, x + 4, y + 4, BOARD_TILE_SIZE - 8, BOARD_TILE_SIZE - 8, color_orange); break;
+	case ENTITY_TYPE_PLAYER_B: soft_fill(target, x + 2, y + 2, BOARD_TILE_SIZE - 4, BOARD_TILE_SIZE - 4, color_salmon); break;
+	case ENTITY_TYPE_PLAYER_BOTH: {
+		soft_fill(target, x + 2, y + 2, BOARD_TILE_SIZE - 4, BOARD_TILE_SIZE - 4, color_salmon);
+		soft_fill(target, x + 4, y + 4, BOARD_TILE_SIZE - 8, BOARD_TILE_SIZE - 8, color_orange);
+	} break;
+	case ENTITY_TYPE_BLOCK: soft_fill(target, x + 2, y + 2, BOARD_TILE_SIZE - 4, BOARD_TILE_SIZE - 4, color_block); break;
+	default: break;
+	}
+}
+
+// render_static_layer, then render_chain and render_entities with t = 1
+static void soft_render(Soft_Target *target, const State *s) {
+	soft_fill(target, 0, 0, WIDTH, HEIGHT, color_bg);
+	for (int i = 0; i < 64; ++i)
+		soft_tile(target, s, i);
+
+	int x = BOARD_TILE_SIZE;
+	int y = HEIGHT - BOARD_TILE_SIZE * 2;
+	for (int i = 0; i < s->collectable_count; ++i) {
+		soft_fill(target, x + 6, y + 6, BOARD_TILE_SIZE / 4, BOARD_TILE_SIZE / 4, color_green);
+		if (s->collected <= i)
+			soft_fill(target, x + 7, y + 7, BOARD_TILE_SIZE / 4 - 2, BOARD_TILE_SIZE / 4 - 2, color_bg);
+		x += BOARD_TILE_SIZE;
+	}
+
+	if (s->player_a_index != s->player_b_index) {
+		int points[4];
+		int count = 0;
+		points[count++] = s->player_a_index;
+		for (int i = 0; i < 2; ++i) {
+			if (s->chain_indices[i] != -1 && s->chain_visible[i])
+				points[count++] = s->chain_indices[i];
+		}
+		points[count++] = s->player_b_index;
+
+		// tiles are neighbours, so every segment is a straight bar
+		int half = BOARD_TILE_SIZE / 8;
+		for (int i = 0; i + 1 < count; ++i) {
+			int ax = points[i] % 8, ay = points[i] / 8;
+			int bx = points[i + 1] % 8, by = points[i + 1] / 8;
+			int x0 = BOARD_OFFSET_X + (ax < bx ? ax : bx) * BOARD_TILE_SIZE + BOARD_TILE_SIZE / 2 - half;
+			int y0 = BOARD_OFFSET_Y + (ay < by ? ay : by) * BOARD_TILE_SIZE + BOARD_TILE_SIZE / 2 - half;
+			int width = (ax < bx ? bx - ax : ax - bx) * BOARD_TILE_SIZE + half * 2;
+			int height = (ay < by ? by - ay : ay - by) * BOARD_TILE_SIZE + half * 2;
+			soft_fill(target, x0, y0, width, height, color_white);
+		}
+	}
+
+	for (int i = 0; i < 64; ++i) {
+		int tile_x = BOARD_OFFSET_X + i % 8 * BOARD_TILE_SIZE;
+		int tile_y = BOARD_OFFSET_Y + i / 8 * BOARD_TILE_SIZE;
+		soft_entity(target, tile_x, tile_y, s->tiles[i].entity);
+	}
+}
+
+static void soft_write_ppm(const Soft_Target *target, const char *path) {
+	FILE *fp = fopen(path, "wb");
+	if (!fp)
+		error_and_exit(-1, "Can't write thumbnail");
+	fprintf(fp, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
+	u8 row[WIDTH * 3];
+	for (int y = 0; y < HEIGHT; ++y) {
+		for (int x = 0; x < WIDTH; ++x) {
+			u32 pixel = target->pixels[y * WIDTH + x];
+			row[x * 3 + 0] = pixel & 0xff;
+			row[x * 3 + 1] = pixel >> 8 & 0xff;
+			row[x * 3 + 2] = pixel >> 16 & 0xff;
+		}
+		fwrite(row, 1, sizeof(row), fp);
+	}
+	fclose(fp);
+}
+
+// from_disk when the paths came from the command line rather than levels
+typedef struct thumbnail_job {
+	const char *out_dir;
+	const char **paths;
+	int count;
+	bool from_disk;
+	atomic_int next;
+} Thumbnail_Job;
+
+// levels are prepared off to the side, not installed, so every thread
+// loads, draws and writes on its own
+static void *thumbnail_main(void *data) {
+	Thumbnail_Job *job = data;
+	Soft_Target *target = malloc(sizeof(Soft_Target));
+	if (!target)
+		error_and_exit(-1, "Can't allocate thumbnail");
+
+	for (;;) {
+		int i = atomic_fetch_add(&job->next, 1);
+		if (i >= job->count)
+			break;
+
+		Prepared_Level level;
+		if (job->from_disk)
+			read_level_file(&level, job->paths[i], i);
+		else
+			prepare_level(&level, job->paths[i], i);
+
+		soft_render(target, &level.state);
+
+		const char *name = strrchr(job->paths[i], '/');
+		name = name ? name + 1 : job->paths[i];
+		int length = strcspn(name, ".");
+		char path[1024];
+		snprintf(path, sizeof(path), "%s/%.*s.ppm", job->out_dir, length, name);
+		soft_write_ppm(target, path);
+	}
+
+	free(target);
+	return NULL;
+}
+
+static long processor_count() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	return sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+// one ppm per level file, no window or gl needed
+static int thumbnail(const char *out_dir, const char **paths, int count, bool from_disk) {
+	f64 start = now_ms();
+
+	Thumbnail_Job job = { out_dir, paths, count, from_disk };
+	atomic_init(&job.next, 0);
+
+	pthread_t threads[64];
+	long thread_count = processor_count();
+	if (thread_count > count)
+		thread_count = count;
+	if (thread_count > 64)
+		thread_count = 64;
+	if (thread_count < 1)
+		thread_count = 1;
+	for (int i = 0; i < thread_count; ++i) {
+		if (pthread_create(&threads[i], NULL, thumbnail_main, &job) != 0)
+			error_and_exit(-1, "Failed to start thumbnail thread");
+	}
+	for (int i = 0; i < thread_count; ++i)
+		pthread_join(threads[i], NULL);
+
+	f64 ms = now_ms() - start;
+	printf("%d thumbnails on %ld threads in %.1f ms\n", count, thread_count, ms);
+	return 0;
+}
+
+// external-memory solver: breadth first over whole layers, with every layer
+// kept on disk as a sorted, delta-compressed run file. successors go out in
+// sorted runs and duplicates are dropped when the runs are merged against
+// the visited file, so memory use is one run buffer no matter how big the
+// state space gets
+#define SOLVER_RUN_STATES (1 << 20)
+#define SOLVER_MAX_MERGE 64
+#define SOLVER_IO_BUFFER (1 << 20)
+
+// tile types only change water -> normal, so a water mask plus the entity
+// codes split into bit planes is enough to rebuild the whole state
+typedef struct packed_state {
+	u64 water;
+	u64 entities[3];
+	u64 meta;
+} Packed_State;
+
+#define PACKED_WORDS (sizeof(Packed_State) / sizeof(u64))
+
+typedef struct run_file {
+	FILE *fp;
+	char *buffer;
+	Packed_State last;
+	u64 count;
+	bool has_last;
+} Run_File;
+
+static State solver_start;
+
+static void pack_state(Packed_State *packed) {
+	memset(packed, 0, sizeof(Packed_State));
+	for (int i = 0; i < 64; ++i) {
+		if (state.tiles[i].type == TILE_TYPE_WATER)
+			packed->water |= (u64)1 << i;
+		for (int plane = 0; plane < 3; ++plane) {
+			packed->entities[plane] |= (u64)(state.tiles[i].entity >> plane & 1) << i;
+		}
+	}
+	packed->meta = state.player_a_index | state.player_b_index << 6 | state.collected << 12 | state.exit_open << 18;
+}
+
+static void unpack_state(const Packed_State *packed) {
+	memcpy(&state, &solver_start, sizeof(State));
+	slides.valid = false;
+	for (int i = 0; i < 64; ++i) {
+		Tile *tile = &state.tiles[i];
+		if (tile->type == TILE_TYPE_WATER && !(packed->water >> i & 1))
+			tile->type = TILE_TYPE_NORMAL;
+		tile->entity = 0;
+		for (int plane = 0; plane < 3; ++plane) {
+			tile->entity |= (packed->entities[plane] >> i & 1) << plane;
+		}
+	}
+	state.player_a_index = packed->meta & 63;
+	state.player_b_index = packed->meta >> 6 & 63;
+	state.collected = packed->meta >> 12 & 63;
+	state.exit_open = packed->meta >> 18 & 1;
+}
+
+static int compare_packed(const void *a, const void *b) {
+	const u64 *x = a;
+	const u64 *y = b;
+	for (int i = 0; i < PACKED_WORDS; ++i) {
+		if (x[i] != y[i])
+			return x[i] < y[i] ? -1 : 1;
+	}
+	return 0;
+}
+
+static void run_open(Run_File *run, const char *path, const char *mode) {
+	memset(run, 0, sizeof(Run_File));
+	run->fp = fopen(path, mode);
+	if (!run->fp)
+		error_and_exit(-1, "Can't open solver run file");
+	run->buffer = malloc(SOLVER_IO_BUFFER);
+	if (!run->buffer)
+		error_and_exit(-1, "Can't allocate solver run buffer");
+	setvbuf(run->fp, run->buffer, _IOFBF, SOLVER_IO_BUFFER);
+}
+
+static void run_close(Run_File *run) {
+	fclose(run->fp);
+	free(run->buffer);
+}
+
+static void write_varint(FILE *fp, u64 value) {
+	while (value >= 0x80) {
+		fputc((int)(value & 0x7f) | 0x80, fp);
+		value >>= 7;
+	}
+	fputc((int)value, fp);
+}
+
+static u64 read_varint(FILE *fp) {
+	u64 value = 0;
+	for (int shift = 0; ; shift += 7) {
+		int c = fgetc(fp);
+		if (c == EOF)
+			error_and_exit(-1, "Truncated solver run file");
+		value |= (u64)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			break;
+	}
+	return value;
+}
+
+// records have to arrive sorted. each one is stored as how many leading words
+// it shares with the previous record, the difference in the first word that
+// changed, then the rest as varints. repeats of the previous record are
+// dropped here, which is where in-run duplicates disappear
+static void run_write(Run_File *run, const Packed_State *packed) {
+	const u64 *words = (const u64 *)packed;
+	const u64 *last = (const u64 *)&run->last;
+	int shared = 0;
+	if (run->has_last) {
+		while (shared < PACKED_WORDS && words[shared] == last[shared])
+			++shared;
+		if (shared == PACKED_WORDS)
+			return;
+	}
+	fputc(shared, run->fp);
+	write_varint(run->fp, words[shared] - (run->has_last ? last[shared] : 0));
+	for (int i = shared + 1; i < PACKED_WORDS; ++i) {
+		write_varint(run->fp, words[i]);
+	}
+	run->last = *packed;
+	run->has_last = true;
+	++run->count;
+}
+
+static bool run_read(Run_File *run, Packed_State *packed) {
+	int shared = fgetc(run->fp);
+	if (shared == EOF)
+		return false;
+	u64 *words = (u64 *)&run->last;
+	words[shared] += read_varint(run->fp);
+	for (int i = shared + 1; i < PACKED_WORDS; ++i) {
+		words[i] = read_varint(run->fp);
+	}
+	*packed = run->last;
+	++run->count;
+	return true;
+}
+
+static void solver_path(char *path, size_t size, const char *dir, const char *name, int n) {
+	snprintf(path, size, "%s/solve-%s-%d.run", dir, name, n);
+}
+
+typedef struct run_merge {
+	Run_File *runs;
+	Packed_State *heads;
+	int *heap;
+	int heap_count;
+} Run_Merge;
+
+static bool merge_less(Run_Merge *merge, int a, int b) {
+	return compare_packed(&merge->heads[merge->heap[a]], &merge->heads[merge->heap[b]]) < 0;
+}
+
+static void merge_sift_down(Run_Merge *merge, int i) {
+	for (;;) {
+		int smallest = i;
+		int left = i * 2 + 1;
+		int right = left + 1;
+		if (left < merge->heap_count && merge_less(merge, left, smallest))
+			smallest = left;
+		if (right < merge->heap_count && merge_less(merge, right, smallest))
+			smallest = right;
+		if (smallest == i)
+			break;
+		int temp = merge->heap[i];
+		merge->heap[i] = merge->heap[smallest];
+		merge->heap[smallest] = temp;
+		i = smallest;
+	}
+}
+
+static void merge_open(Run_Merge *merge, const char *dir, const char *name, int first, int count) {
+	char path[1024];
+	merge->runs = malloc(count * sizeof(Run_File));
+	merge->heads = malloc(count * sizeof(Packed_State));
+	merge->heap = malloc(count * sizeof(int));
+	merge->heap_count = 0;
+	for (int i = 0; i < count; ++i) {
+		solver_path(path, sizeof(path), dir, name, first + i);
+		run_open(&merge->runs[i], path, "rb");
+		if (run_read(&merge->runs[i], &merge->heads[i]))
+			merge->heap[merge->heap_count++] = i;
+	}
+	for (int i = merge->heap_count / 2 - 1; i >= 0; --i) {
+		merge_sift_down(merge, i);
+	}
+}
+
+// smallest record across all runs, duplicates included
+static bool merge_next(Run_Merge *merge, Packed_State *packed) {
+	if (merge->heap_count == 0)
+		return false;
+	int top = merge->heap[0];
+	*packed = merge->heads[top];
+	if (!run_read(&merge->runs[top], &merge->heads[top]))
+		merge->heap[0] = merge->heap[--merge->heap_count];
+	merge_sift_down(merge, 0);
+	return true;
+}
+
+static void merge_close(Run_Merge *merge, const char *dir, const char *name, int first, int count) {
+	char path[1024];
+	for (int i = 0; i < count; ++i) {
+		run_close(&merge->runs[i]);
+		solver_path(path, sizeof(path), dir, name, first + i);
+		remove(path);
+	}
+	free(merge->runs);
+	free(merge->heads);
+	free(merge->heap);
+}
+
+// keep the number of open files bounded by merging runs in groups until
+// few enough are left for the final pass. returns the new run count
+static int reduce_runs(const char *dir, int run_count) {
+	char path[1024];
+	while (run_count > SOLVER_MAX_MERGE) {
+		int merged_count = 0;
+		for (int first = 0; first < run_count; first += SOLVER_MAX_MERGE) {
+			int count = run_count - first < SOLVER_MAX_MERGE ? run_count - first : SOLVER_MAX_MERGE;
+			Run_Merge merge;
+			merge_open(&merge, dir, "run", first, count);
+			Run_File out;
+			solver_path(path, sizeof(path), dir, "merge", merged_count);
+			run_open(&out, path, "wb");
+			Packed_State packed;
+			while (merge_next(&merge, &packed)) {
+				run_write(&out, &packed);
+			}
+			run_close(&out);
+			merge_close(&merge, dir, "run", first, count);
+			++merged_count;
+		}
+		for (int i = 0; i < merged_count; ++i) {
+			char from[1024];
+			solver_path(from, sizeof(from), dir, "merge", i);
+			solver_path(path, sizeof(path), dir, "run", i);
+			rename(from, path);
+		}
+		run_count = merged_count;
+	}
+	return run_count;
+}
+
+static void write_sorted_run(const char *dir, int n, Packed_State *buffer, int count) {
+	char path[1024];
+	qsort(buffer, count, sizeof(Packed_State), compare_packed);
+	Run_File run;
+	solver_path(path, sizeof(path), dir, "run", n);
+	run_open(&run, path, "wb");
+	for (int i = 0; i < count; ++i) {
+		run_write(&run, &buffer[i]);
+	}
+	run_close(&run);
+}
+
+// walk back through the kept layers to find which moves led to the goal
+static void print_solution(const char *dir, int depth, Packed_State target, int last_direction) {
+	static const char names[] = "LRUD";
+	char *moves = malloc(depth + 2);
+	char path[1024];
+	moves[depth] = names[last_direction];
+	moves[depth + 1] = 0;
+	for (int layer = depth - 1; layer >= 0; --layer) {
+		Run_File run;
+		solver_path(path, sizeof(path), dir, "layer", layer);
+		run_open(&run, path, "rb");
+		Packed_State parent;
+		Move_Events events;
+		bool found = false;
+		while (!found && run_read(&run, &parent)) {
+			for (int direction = LEFT; direction <= DOWN && !found; ++direction) {
+				unpack_state(&parent);
+				if (try_move(direction, state.player_a_index, &events) != MOVE_RESULT_NONE)
+					continue;
+				Packed_State child;
+				pack_state(&child);
+				if (compare_packed(&child, &target) == 0) {
+					moves[layer] = names[direction];
+					target = parent;
+					found = true;
+				}
+			}
+		}
+		run_close(&run);
+		if (!found)
+			error_and_exit(-1, "Lost the solution path");
+	}
+	printf("solution (%d moves): %s\n", depth + 1, moves);
+	free(moves);
+}
+
+// level is a level file, or the number of one of the game's own levels
+static int solve(const char *level, const char *dir) {
+	char path[1024];
+	char visited_path[1024];
+	char next_visited_path[1024];
+
+	char *end;
+	long number = strtol(level, &end, 10);
+	if (*end == 0) {
+		if (number < 1 || number > (long)(sizeof(levels) / sizeof(levels[0])))
+			error_and_exit(-1, "No such level");
+		Prepared_Level prepared;
+		prepare_level(&prepared, levels[number - 1], number - 1);
+		install_level(&prepared);
+	} else {
+		load_level_file(level, 0);
+	}
+	memcpy(&solver_start, &state, sizeof(State));
+
+	Packed_State *buffer = malloc(SOLVER_RUN_STATES * sizeof(Packed_State));
+	if (!buffer)
+		error_and_exit(-1, "Can't allocate solver buffer");
+
+	Packed_State start;
+	pack_state(&start);
+	Run_File run;
+	solver_path(path, sizeof(path), dir, "layer", 0);
+	run_open(&run, path, "wb");
+	run_write(&run, &start);
+	run_close(&run);
+	solver_path(visited_path, sizeof(visited_path), dir, "visited", 0);
+	run_open(&run, visited_path, "wb");
+	run_write(&run, &start);
+	run_close(&run);
+
+	u64 frontier_count = 1;
+	u64 visited_count = 1;
+	int depth = 0;
+	int solved = 0;
+	Packed_State goal_parent;
+	int goal_direction = -1;
+
+	while (frontier_count > 0) {
+		// expand the frontier into sorted runs
+		int run_count = 0;
+		int buffered = 0;
+		solver_path(path, sizeof(path), dir, "layer", depth);
+		Run_File frontier;
+		run_open(&frontier, path, "rb");
+		Packed_State packed;
+		Move_Events events;
+		while (goal_direction == -1 && run_read(&frontier, &packed)) {
+			for (int direction = LEFT; direction <= DOWN; ++direction) {
+				unpack_state(&packed);
+				Move_Result result = try_move(direction, state.player_a_index, &events);
+				if (result == MOVE_RESULT_LEVEL_COMPLETE) {
+					goal_parent = packed;
+					goal_direction = direction;
+					break;
+				}
+				if (result != MOVE_RESULT_NONE || is_dead_state())
+					continue;
+				pack_state(&buffer[buffered++]);
+				if (buffered == SOLVER_RUN_STATES) {
+					write_sorted_run(dir, run_count++, buffer, buffered);
+					buffered = 0;
+				}
+			}
+		}
+		run_close(&frontier);
+		if (goal_direction != -1) {
+			for (int i = 0; i < run_count; ++i) {
+				solver_path(path, sizeof(path), dir, "run", i);
+				remove(path);
+			}
+			print_solution(dir, depth, goal_parent, goal_direction);
+			solved = 1;
+			break;
+		}
+		if (buffered > 0 || run_count == 0)
+			write_sorted_run(dir, run_count++, buffer, buffered);
+		run_count = reduce_runs(dir, run_count);
+
+		// merge the runs against everything seen so far. anything new is the
+		// next layer, and the visited file is rewritten with it mixed in
+		Run_Merge merge;
+		merge_open(&merge, dir, "run", 0, run_count);
+		Run_File visited, next_visited, next_frontier;
+		run_open(&visited, visited_path, "rb");
+		solver_path(next_visited_path, sizeof(next_visited_path), dir, "visited", depth + 1);
+		run_open(&next_visited, next_visited_path, "wb");
+		solver_path(path, sizeof(path), dir, "layer", depth + 1);
+		run_open(&next_frontier, path, "wb");
+
+		Packed_State seen;
+		bool has_seen = run_read(&visited, &seen);
+		while (merge_next(&merge, &packed)) {
+			while (has_seen && compare_packed(&seen, &packed) < 0) {
+				run_write(&next_visited, &seen);
+				has_seen = run_read(&visited, &seen);
+			}
+			if (has_seen && compare_packed(&seen, &packed) == 0)
+				continue;
+			run_write(&next_frontier, &packed);
+			run_write(&next_visited, &packed);
+		}
+		while (has_seen) {
+			run_write(&next_visited, &seen);
+			has_seen = run_read(&visited, &seen);
+		}
+
+		merge_close(&merge, dir, "run", 0, run_count);
+		frontier_count = next_frontier.count;
+		visited_count = next_visited.count;
+		run_close(&visited);
+		run_close(&next_visited);
+		run_close(&next_frontier);
+		remove(visited_path);
+		strcpy(visited_path, next_visited_path);
+
+		++depth;
+		printf("depth %d: %llu new, %llu visited\n", depth, (unsigned long long)frontier_count, (unsigned long long)visited_count);
+		fflush(stdout);
+	}
+
+	if (!solved)
+		printf("level %s can't be solved (%llu states)\n", level, (unsigned long long)visited_count);
+
+	remove(visited_path);
+	for (int i = 0; i <= depth; ++i) {
+		solver_path(path, sizeof(path), dir, "layer", i);
+		remove(path);
+	}
+	free(buffer);
+
+	return solved ? 0 : 1;
+}
+
+// benchmark of the simulation kernels. wall time everywhere, plus hardware
+// counters from perf_event_open on linux when the kernel lets us have them
+// (perf_event_paranoid, or no pmu in a vm, can leave some or all out)
+typedef struct bench_run {
+	f64 ns;
+	u64 counts[BENCH_COUNTERS];
+	bool counted[BENCH_COUNTERS];
+	u64 allocations;
+	i64 live;
+} Bench_Run;
+
+static const char *bench_counter_names[BENCH_COUNTERS] = { "cycles", "instr", "br-miss", "l1d-miss", "llc-miss" };
+static int bench_fds[BENCH_COUNTERS] = { -1, -1, -1, -1, -1 };
+static volatile int bench_sink;
+
+static void bench_open_counters() {
+#ifdef __linux__
+	const u64 configs[BENCH_COUNTERS][2] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+	};
+	for (int i = 0; i < BENCH_COUNTERS; ++i) {
+		struct perf_event_attr attr = {0};
+		attr.size = sizeof(attr);
+		attr.type = configs[i][0];
+		attr.config = configs[i][1];
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		bench_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (bench_fds[i] < 0)
+			fprintf(stderr, "No %s counter: %s\n", bench_counter_names[i], strerror(errno));
+	}
+#endif
+}
+
+static void bench_start(Bench_Run *run) {
+#ifdef __linux__
+	for (int i = 0; i < BENCH_COUNTERS; ++i) {
+		if (bench_fds[i] < 0)
+			continue;
+		ioctl(bench_fds[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(bench_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif
+	run->allocations = thread_allocations;
+	run->live = live_allocations();
+	run->ns = now_ms() * 1e6;
 }
 
-int main(void) {
+static void bench_stop(Bench_Run *run) {
+	run->ns = now_ms() * 1e6 - run->ns;
+	run->allocations = thread_allocations - run->allocations;
+	run->live = live_allocations() - run->live;
+	for (int i = 0; i < BENCH_COUNTERS; ++i) {
+		run->counted[i] = false;
+#ifdef __linux__
+		if (bench_fds[i] < 0)
+			continue;
+		ioctl(bench_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		run->counted[i] = read(bench_fds[i], &run->counts[i], sizeof(u64)) == sizeof(u64);
+#endif
+	}
+}
+
+static void bench_report(const char *name, const Bench_Run *run, u64 ops) {
+	printf("%-10s %10llu %9.1f", name, (unsigned long long)ops, run->ns / ops);
+	for (int i = 0; i < BENCH_COUNTERS; ++i) {
+		if (run->counted[i])
+			printf(" %9.2f", (f64)run->counts[i] / ops);
+		else
+			printf(" %9s", "-");
+	}
+	if (run->counted[0] && run->counted[1] && run->counts[0])
+		printf(" %5.2f", (f64)run->counts[1] / run->counts[0]);
+	else
+		printf(" %5s", "-");
+#ifdef TRACK_ALLOCATIONS
+	printf(" %7.2f %6lld\n", (f64)run->allocations / ops, (long long)run->live);
+#else
+	printf("\n");
+#endif
+}
+
+// the kernels run over and over on a loaded level, so nothing they allocate
+// should outlive them. a block still live afterwards fails the benchmark, and
+// so does any allocation at all from the ones that run every move
+static bool bench_failed(const char *name, const Bench_Run *run, bool steady) {
+	if (run->live != 0) {
+		fprintf(stderr, "Error: %s leaked %lld allocations\n", name, (long long)run->live);
+		return true;
+	}
+	if (steady && run->allocations > 0) {
+		fprintf(stderr, "Error: %s made %llu allocations\n", name, (unsigned long long)run->allocations);
+		return true;
+	}
+	return false;
+}
+
+// ops per kernel per level, times the scale given on the command line
+static int bench(int scale) {
+	const int level_count = sizeof(levels) / sizeof(levels[0]);
+	const u64 try_move_ops = 200000ull * scale;
+	const u64 bfs_ops = 50000ull * scale;
+	const u64 can_move_ops = 2000000ull * scale;
+	const u64 load_level_ops = 20000ull * scale;
+
+	bench_open_counters();
+	printf("%-10s %10s %9s", "kernel", "ops", "ns/op");
+	for (int i = 0; i < BENCH_COUNTERS; ++i)
+		printf(" %9s", bench_counter_names[i]);
+	printf(" %5s", "ipc");
+#ifdef TRACK_ALLOCATIONS
+	printf(" %7s %6s\n", "allocs", "leaked");
+#else
+	printf("\n");
+#endif
+
+	// a seeded random walk, back to the start whenever the level ends, so
+	// every push, pull and splash the levels have gets its share
+	Bench_Run run;
+	Move_Events events;
+	bool failed = false;
+	u32 seed = 1;
+	// the analysis goes with the state, the rules read it
+	static Prepared_Level starts[sizeof(levels) / sizeof(levels[0])];
+	for (int level = 0; level < level_count; ++level)
+		prepare_level(&starts[level], levels[level], level);
+	u64 ops = 0;
+	bench_start(&run);
+	for (int level = 0; level < level_count; ++level) {
+		install_level(&starts[level]);
+		for (u64 i = 0; i < try_move_ops; ++i) {
+			seed = seed * 1664525 + 1013904223;
+			if (try_move(seed >> 30, state.player_a_index, &events) != MOVE_RESULT_NONE)
+				install_level(&starts[level]);
+		}
+		ops += try_move_ops;
+	}
+	bench_stop(&run);
+	bench_report("try_move", &run, ops);
+	failed |= bench_failed("try_move", &run, true);
+
+	ops = 0;
+	bench_start(&run);
+	for (int level = 0; level < level_count; ++level) {
+		install_level(&starts[level]);
+		for (u64 i = 0; i < bfs_ops; ++i)
+			bench_sink = bfs(&state, state.player_a_index, state.player_b_index, i & 3).distance;
+		ops += bfs_ops;
+	}
+	bench_stop(&run);
+	bench_report("bfs", &run, ops);
+	failed |= bench_failed("bfs", &run, true);
+
+	ops = 0;
+	bench_start(&run);
+	for (int level = 0; level < level_count; ++level) {
+		install_level(&starts[level]);
+		for (u64 i = 0; i < can_move_ops; ++i)
+			bench_sink = can_move(i & 3, (i >> 2) & 63);
+		ops += can_move_ops;
+	}
+	bench_stop(&run);
+	bench_report("can_move", &run, ops);
+	failed |= bench_failed("can_move", &run, true);
+
+	ops = 0;
+	bench_start(&run);
+	for (int level = 0; level < level_count; ++level) {
+		for (u64 i = 0; i < load_level_ops; ++i) {
+			Prepared_Level prepared;
+			prepare_level(&prepared, levels[level], level);
+			install_level(&prepared);
+		}
+		ops += load_level_ops;
+	}
+	bench_stop(&run);
+	bench_report("load_level", &run, ops);
+	failed |= bench_failed("load_level", &run, false);
+
+	return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+	startup_time = now_ms();
+	setup_move_rules();
+#ifdef TRACK_ALLOCATIONS
+	atexit(print_allocations);
+#endif
+
+	if (argc > 1 && strcmp(argv[1], "solve") == 0) {
+		if (argc < 3)
+			error_and_exit(-1, "Usage: solve <level file|level number> [work dir]");
+		return solve(argv[2], argc > 3 ? argv[3] : ".");
+	}
+	if (argc > 1 && strcmp(argv[1], "bench") == 0)
+		return bench(argc > 2 && atoi(argv[2]) > 0 ? atoi(argv[2]) : 1);
+	if (argc > 1 && strcmp(argv[1], "replay") == 0) {
+		if (argc < 4)
+			error_and_exit(-1, "Usage: replay <level> <moves file> [scale] > out.y4m");
+#ifdef __linux__
+		return replay(atoi(argv[2]) - 1, argv[3], argc > 4 ? atoi(argv[4]) : 1);
+#else
+		error_and_exit(-1, "Replay needs EGL");
+#endif
+	}
+	if (argc > 1 && strcmp(argv[1], "thumbnail") == 0) {
+		if (argc < 3)
+			error_and_exit(-1, "Usage: thumbnail <out dir> [level files]");
+		if (argc > 3)
+			return thumbnail(argv[2], (const char **)&argv[3], argc - 3, true);
+		return thumbnail(argv[2], levels, sizeof(levels) / sizeof(levels[0]), false);
+	}
+
+	if (argc > 1 && strcmp(argv[1], "stats") == 0)
+		start_frame_stats(argc > 2 ? argv[2] : NULL);
+	if (argc > 1 && strcmp(argv[1], "latency") == 0)
+		latency_stats.enabled = true;
+
+	start_preload();
 	setup_window();
+	finish_preload();
 	setup_rendering();
 	setup_shaders();
 
-	load_level(0);
+	start_simulation();
 
+	// state belongs to the simulation thread now
+	int level = acquire_state()->current.level_index;
+	f64 frame_start = now_ms();
 	while (!glfwWindowShouldClose(window)) {
-		render();
+		glfwPollEvents();
+		const Snapshot *snapshot = acquire_state();
+		render(snapshot);
+
+		// used to be the worst frame of a session, so it is checked every time
+		f64 frame_end = now_ms();
+		if (snapshot->current.level_index != level && frame_end - frame_start > TRANSITION_BUDGET_MS)
+			fprintf(stderr, "Warning: level %d took %.1f ms to show, over the %.1f ms budget\n",
+				snapshot->current.level_index + 1, frame_end - frame_start, TRANSITION_BUDGET_MS);
+		level = snapshot->current.level_index;
+		frame_start = frame_end;
 	}
 
+	// finish_frame_stats closes the log, so ask first
+	bool watched = watching();
+	stop_simulation();
+	finish_frame_stats();
+	print_latency();
 	glfwTerminate();
 
+	// only when stats or latency were being watched, like the rest
+	if (render_cache.frames > 0 && watched)
+		printf("%llu frames, %.1f gl calls per frame, %llu stream stalls, %llu orphans\n",
+			(unsigned long long)render_cache.frames, (f64)render_cache.total_calls / render_cache.frames,
+			(unsigned long long)stream.stalls, (unsigned long long)stream.orphans);
+
 	return 0;
 }
@@ -1,7 +1,7 @@
-#version 330 core
+// #version and the Globals block come from shader_header in main.c
 out vec4 FragColor;
 
-uniform vec4 color;
+in vec4 color;
 
 void main() {
 	FragColor = color;
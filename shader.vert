@@ -1,9 +1,10 @@
-#version 330 core
-layout (location = 0) in vec3 pos;
+// #version and the Globals block come from shader_header in main.c
+layout (location = 0) in vec2 pos;
+layout (location = 1) in vec4 vertex_color;
 
-uniform mat4 projection;
-uniform mat4 model;
+out vec4 color;
 
 void main() {
-	gl_Position = projection * model * vec4(pos, 1.0);
+	color = vertex_color;
+	gl_Position = projection * vec4(pos, 0.0, 1.0);
 }